@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
 
 // calculate the relative-difference between absolute times while
 // correctly handling overflow conditions
@@ -23,432 +24,3128 @@ static inline int equeue_clampdiff(unsigned a, unsigned b) {
     return ~(diff >> (8*sizeof(int)-1)) & diff;
 }
 
-// Increment the unique id in an event, hiding the event from cancel
-static inline void equeue_incid(equeue_t *q, struct equeue_event *e) {
-    e->id += 1;
-    if ((e->id << q->npw2) == 0) {
-        e->id = 1;
+// convert milliseconds and microseconds to ticks, saturating so that large
+// delays still compare correctly with equeue_tickdiff, negative values are
+// left alone since they are used to disable delays and periods
+static inline int equeue_ms2tick(int ms) {
+#if defined(EQUEUE_TICK_US)
+    if (ms > INT_MAX/1000) {
+        return INT_MAX;
     }
+    return (ms < 0) ? ms : ms*1000;
+#else
+    return ms;
+#endif
 }
 
+static inline int equeue_us2tick(int us) {
+#if defined(EQUEUE_TICK_US)
+    return us;
+#else
+    // round up to the next millisecond
+    return (us <= 0) ? us : us/1000 + (us % 1000 != 0);
+#endif
+}
 
-// equeue lifetime management
-int equeue_create(equeue_t *q, size_t size) {
-    // dynamically allocate the specified buffer
-    void *buffer = malloc(size);
-    if (!buffer) {
-        return -1;
-    }
+// convert ticks to milliseconds and microseconds, rounding up so that
+// pending events never appear to be due early
+static inline int equeue_tick2ms(int ticks) {
+#if defined(EQUEUE_TICK_US)
+    return (ticks <= 0) ? ticks : ticks/1000 + (ticks % 1000 != 0);
+#else
+    return ticks;
+#endif
+}
 
-    int err = equeue_create_inplace(q, size, buffer);
-    q->allocated = buffer;
-    return err;
+static inline int equeue_tick2us(int ticks) {
+#if defined(EQUEUE_TICK_US)
+    return ticks;
+#else
+    if (ticks > INT_MAX/1000) {
+        return INT_MAX;
+    }
+    return (ticks < 0) ? ticks : ticks*1000;
+#endif
 }
 
-int equeue_create_inplace(equeue_t *q, size_t size, void *buffer) {
-    // setup queue around provided buffer
-    // ensure buffer and size are aligned
-    q->buffer = (void *)(((uintptr_t) buffer + sizeof(void *) -1) & ~(sizeof(void *) -1));
-    size -= (char *) q->buffer - (char *) buffer;
-    size &= ~(sizeof(void *) -1);
+// find an event's offset in the queue's memory, with growable queues the
+// region goes in the top bits of the offset
+static inline size_t equeue_offset(equeue_t *q, struct equeue_event *e) {
+#if defined(EQUEUE_GROWABLE)
+    for (unsigned i = 1; i < q->nregions; i++) {
+        struct equeue_region *r = &q->regions[i];
+        if ((unsigned char *)e >= r->buffer &&
+                (unsigned char *)e < r->buffer + r->size) {
+            return ((size_t)i << (q->npw2 - EQUEUE_REGION_BITS)) |
+                    (size_t)((unsigned char *)e - r->buffer);
+        }
+    }
+#endif
 
-    q->allocated = 0;
+    return (unsigned char *)e - q->buffer;
+}
 
-    q->npw2 = 0;
-    for (unsigned s = size; s; s >>= 1) {
-        q->npw2++;
+// find the event at an offset, returns null if the offset is out of range
+static inline struct equeue_event *equeue_at(equeue_t *q, size_t off) {
+#if defined(EQUEUE_GROWABLE)
+    size_t i = off >> (q->npw2 - EQUEUE_REGION_BITS);
+    off &= ((size_t)1 << (q->npw2 - EQUEUE_REGION_BITS)) - 1;
+    if (i >= q->nregions || off >= q->regions[i].size) {
+        return 0;
     }
 
-    q->chunks = 0;
-    q->slab.size = size;
-    q->slab.data = q->buffer;
+    return (struct equeue_event *)&q->regions[i].buffer[off];
+#else
+    return (struct equeue_event *)&q->buffer[off];
+#endif
+}
 
-    q->queue = 0;
-    q->tick = equeue_tick();
-    q->generation = 0;
-    q->break_requested = false;
+// hash the local id with the event's buffer offset for a unique handle,
+// int ids are the bottom bits of the handle
+static inline equeue_id64_t equeue_id64(equeue_t *q, struct equeue_event *e) {
+    return ((equeue_id64_t)e->id << q->npw2) | equeue_offset(q, e);
+}
 
-    q->background.active = false;
-    q->background.update = 0;
-    q->background.timer = 0;
+static inline int equeue_id(equeue_t *q, struct equeue_event *e) {
+    return (int)(uint32_t)equeue_id64(q, e);
+}
 
-    // initialize platform resources
-    int err;
-    err = equeue_sema_create(&q->eventsema);
-    if (err < 0) {
-        return err;
+// follow and create links between events, with compact events links are
+// offsets from the word before the buffer so no event has a null link, and
+// a null ref refers to the head of the event's list
+#if defined(EQUEUE_COMPACT_EVENTS)
+static inline struct equeue_event *equeue_ptr(equeue_t *q, equeue_link_t l) {
+    return l ? (struct equeue_event *)&q->buffer[l - sizeof(void*)] : 0;
+}
+
+static inline equeue_link_t equeue_link(equeue_t *q, struct equeue_event *e) {
+    return e ? (equeue_link_t)
+            ((unsigned char *)e - q->buffer + sizeof(void*)) : 0;
+}
+
+static inline equeue_link_t *equeue_slot(equeue_t *q,
+        equeue_ref_t ref, equeue_link_t *head) {
+    return ref ? (equeue_link_t *)&q->buffer[ref - sizeof(void*)] : head;
+}
+
+static inline equeue_ref_t equeue_ref(equeue_t *q,
+        equeue_link_t *slot, equeue_link_t *head) {
+    return (slot == head) ? 0 : (equeue_ref_t)
+            ((unsigned char *)slot - q->buffer + sizeof(void*));
+}
+#else
+static inline struct equeue_event *equeue_ptr(equeue_t *q, equeue_link_t l) {
+    return l;
+}
+
+static inline equeue_link_t equeue_link(equeue_t *q, struct equeue_event *e) {
+    return e;
+}
+
+static inline equeue_link_t *equeue_slot(equeue_t *q,
+        equeue_ref_t ref, equeue_link_t *head) {
+    return ref;
+}
+
+static inline equeue_ref_t equeue_ref(equeue_t *q,
+        equeue_link_t *slot, equeue_link_t *head) {
+    return slot;
+}
+#endif
+
+// with compact events the period and destructor live in an extension at the
+// end of the chunk, events with an extension are marked by the top bit of
+// their slack
+#if defined(EQUEUE_COMPACT_EVENTS)
+#define EQUEUE_SLACK_EXT 0x8000
+
+static inline struct equeue_event_ext *equeue_ext(struct equeue_event *e) {
+    return (e->slack & EQUEUE_SLACK_EXT) ? (struct equeue_event_ext *)
+            ((unsigned char *)e + e->size) - 1 : 0;
+}
+
+static inline int equeue_period(struct equeue_event *e) {
+    struct equeue_event_ext *x = equeue_ext(e);
+    return x ? x->period : -1;
+}
+
+static inline void equeue_setperiod(struct equeue_event *e, int period) {
+    struct equeue_event_ext *x = equeue_ext(e);
+    if (x) {
+        x->period = period;
     }
+}
 
-    err = equeue_mutex_create(&q->queuelock);
-    if (err < 0) {
-        return err;
+static inline void equeue_setdtor(struct equeue_event *e,
+        void (*dtor)(void *)) {
+    struct equeue_event_ext *x = equeue_ext(e);
+    if (x) {
+        x->dtor = dtor;
     }
+}
 
-    err = equeue_mutex_create(&q->memlock);
-    if (err < 0) {
-        return err;
+static inline void equeue_calldtor(struct equeue_event *e) {
+    struct equeue_event_ext *x = equeue_ext(e);
+    if (x && x->dtor) {
+        x->dtor(e + 1);
     }
+}
+#else
+#define EQUEUE_SLACK_EXT 0
 
-    return 0;
+static inline int equeue_period(struct equeue_event *e) {
+    return e->period;
 }
 
-void equeue_destroy(equeue_t *q) {
-    // call destructors on pending events
-    for (struct equeue_event *es = q->queue; es; es = es->next) {
-        for (struct equeue_event *e = es->sibling; e; e = e->sibling) {
-            if (e->dtor) {
-                e->dtor(e + 1);
-            }
-        }
-        if (es->dtor) {
-            es->dtor(es + 1);
-        }
-    }
-    // notify background timer
-    if (q->background.update) {
-        q->background.update(q->background.timer, -1);
+static inline void equeue_setperiod(struct equeue_event *e, int period) {
+    e->period = period;
+}
+
+static inline void equeue_setdtor(struct equeue_event *e,
+        void (*dtor)(void *)) {
+    e->dtor = dtor;
+}
+
+static inline void equeue_calldtor(struct equeue_event *e) {
+    if (e->dtor) {
+        e->dtor(e + 1);
     }
+}
+#endif
 
-    // clean up platform resources + memory
-    equeue_mutex_destroy(&q->memlock);
-    equeue_mutex_destroy(&q->queuelock);
-    equeue_sema_destroy(&q->eventsema);
-    free(q->allocated);
+// with priorities, the event's priority is kept in the top bits of its slack
+// below the extension bit, what's left is the slack itself
+#if defined(EQUEUE_PRIORITIES)
+#define EQUEUE_SLACK_PRIORITY_SHIFT (EQUEUE_SLACK_EXT ? 13 : 14)
+#define EQUEUE_SLACK_PRIORITY (0x3 << EQUEUE_SLACK_PRIORITY_SHIFT)
+
+static inline unsigned equeue_priority(struct equeue_event *e) {
+    return (e->slack & EQUEUE_SLACK_PRIORITY) >> EQUEUE_SLACK_PRIORITY_SHIFT;
+}
+#else
+#define EQUEUE_SLACK_PRIORITY 0
+#endif
+
+#define EQUEUE_SLACK_MASK \
+        (0xffff & ~(EQUEUE_SLACK_EXT | EQUEUE_SLACK_PRIORITY))
+
+// align a target to the coarsest tick boundary in [target, target+slack],
+// clearing the bits below the highest bit that differs over the window
+static inline unsigned equeue_slack(unsigned target, unsigned slack) {
+    unsigned limit = target + slack;
+    unsigned mask = target ^ limit;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    return limit & ~(mask >> 1);
 }
 
+#if !defined(EQUEUE_SCHEDULER_HEAP)
+// stable merge sort of a list of events by target
+static struct equeue_event *equeue_list_sort(equeue_t *q,
+        struct equeue_event *es) {
+    for (unsigned width = 1;; width *= 2) {
+        equeue_link_t head = 0;
+        equeue_link_t *tail = &head;
+        unsigned merges = 0;
 
-// equeue chunk allocation functions
-static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size) {
-    // add event overhead
-    size += sizeof(struct equeue_event);
-    size = (size + sizeof(void*)-1) & ~(sizeof(void*)-1);
+        while (es) {
+            // split off two runs of the current width
+            struct equeue_event *a = es;
+            unsigned alen = 0;
+            while (es && alen < width) {
+                es = equeue_ptr(q, es->next);
+                alen += 1;
+            }
 
-    equeue_mutex_lock(&q->memlock);
+            struct equeue_event *b = es;
+            unsigned blen = 0;
+            while (es && blen < width) {
+                es = equeue_ptr(q, es->next);
+                blen += 1;
+            }
 
-    // check if a good chunk is available
-    for (struct equeue_event **p = &q->chunks; *p; p = &(*p)->next) {
-        if ((*p)->size >= size) {
-            struct equeue_event *e = *p;
-            if (e->sibling) {
-                *p = e->sibling;
-                (*p)->next = e->next;
-            } else {
-                *p = e->next;
+            // merge, preferring the first run for equal targets
+            while (alen || blen) {
+                struct equeue_event *e;
+                if (!blen || (alen &&
+                        equeue_tickdiff(b->target, a->target) >= 0)) {
+                    e = a;
+                    a = equeue_ptr(q, a->next);
+                    alen -= 1;
+                } else {
+                    e = b;
+                    b = equeue_ptr(q, b->next);
+                    blen -= 1;
+                }
+
+                *tail = equeue_link(q, e);
+                tail = &e->next;
             }
 
-            equeue_mutex_unlock(&q->memlock);
-            return e;
+            merges += 1;
         }
-    }
 
-    // otherwise allocate a new chunk out of the slab
-    if (q->slab.size >= size) {
-        struct equeue_event *e = (struct equeue_event *)q->slab.data;
-        q->slab.data += size;
-        q->slab.size -= size;
-        e->size = size;
-        e->id = 1;
+        *tail = 0;
+        if (merges <= 1) {
+            return equeue_ptr(q, head);
+        }
 
-        equeue_mutex_unlock(&q->memlock);
-        return e;
+        es = equeue_ptr(q, head);
     }
-
-    equeue_mutex_unlock(&q->memlock);
-    return 0;
+}
+#endif
+
+// find the first set bit in a non-zero word
+static inline unsigned equeue_ctz(uint32_t a) {
+#if defined(__GNUC__)
+    return __builtin_ctz(a);
+#else
+    unsigned r = 0;
+    while (!(a & 1)) {
+        a >>= 1;
+        r += 1;
+    }
+    return r;
+#endif
 }
 
-static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e) {
-    equeue_mutex_lock(&q->memlock);
+#if defined(EQUEUE_SCHEDULER_WHEEL) || defined(EQUEUE_ALLOCATOR_BINS)
+// find the first set bit in a range of a bitmap, returns -1 if none are set
+static int equeue_bitmap_find(const uint32_t *map, unsigned from, unsigned to) {
+    while (from < to) {
+        uint32_t word = map[from/32] & (0xffffffff << (from % 32));
+        if (word) {
+            unsigned i = (from & ~31) + equeue_ctz(word);
+            return i < to ? (int)i : -1;
+        }
 
-    // stick chunk into list of chunks
-    struct equeue_event **p = &q->chunks;
-    while (*p && (*p)->size < e->size) {
-        p = &(*p)->next;
+        from = (from & ~31) + 32;
     }
 
-    if (*p && (*p)->size == e->size) {
-        e->sibling = *p;
-        e->next = (*p)->next;
-    } else {
-        e->sibling = 0;
-        e->next = *p;
+    return -1;
+}
+#endif
+
+// Increment the unique id in an event, hiding the event from cancel
+static inline void equeue_incid(equeue_t *q, struct equeue_event *e) {
+    e->id += 1;
+#if defined(EQUEUE_WIDE_IDS)
+    // skip local ids that would vanish from int ids
+    if (q->npw2 < 32 && (uint32_t)(e->id << q->npw2) == 0) {
+        e->id += 1;
     }
-    *p = e;
 
-    equeue_mutex_unlock(&q->memlock);
+    if (!e->id) {
+        e->id = 1;
+    }
+#else
+    if ((e->id << q->npw2) == 0) {
+        e->id = 1;
+    }
+#endif
 }
 
-void *equeue_alloc(equeue_t *q, size_t size) {
-    struct equeue_event *e = equeue_mem_alloc(q, size);
-    if (!e) {
-        return 0;
+
+// ready events skip the scheduler and wait in the ready list, with
+// priorities the list is ordered by priority, and each level's tail is the
+// link after the last event of that or a higher priority, so events can be
+// appended to the end of their level, must be called with the queuelock held
+static void equeue_ready_reset(equeue_t *q) {
+    q->ready = 0;
+    q->tail = &q->ready;
+#if defined(EQUEUE_PRIORITIES)
+    for (unsigned i = 0; i < EQUEUE_PRIORITY_LEVELS; i++) {
+        q->levels[i] = &q->ready;
     }
+#endif
+}
 
-    e->target = 0;
-    e->period = -1;
-    e->dtor = 0;
+static void equeue_ready_push(equeue_t *q, struct equeue_event *e) {
+#if defined(EQUEUE_PRIORITIES)
+    unsigned p = equeue_priority(e);
+    equeue_link_t *slot = q->levels[p];
+    e->next = *slot;
+    e->ref = equeue_ref(q, slot, &q->ready);
+    *slot = equeue_link(q, e);
+    if (e->next) {
+        equeue_ptr(q, e->next)->ref = equeue_ref(q, &e->next, &q->ready);
+    }
 
-    return e + 1;
+    // empty lower levels end where this level ends
+    for (unsigned i = 0; i <= p; i++) {
+        if (q->levels[i] == slot) {
+            q->levels[i] = &e->next;
+        }
+    }
+    q->tail = q->levels[0];
+#else
+    e->next = 0;
+    e->ref = equeue_ref(q, q->tail, &q->ready);
+    *q->tail = equeue_link(q, e);
+    q->tail = &e->next;
+#endif
 }
 
-void equeue_dealloc(equeue_t *q, void *p) {
-    struct equeue_event *e = (struct equeue_event*)p - 1;
-
-    if (e->dtor) {
-        e->dtor(e+1);
+static void equeue_ready_remove(equeue_t *q, struct equeue_event *e) {
+    equeue_link_t *slot = equeue_slot(q, e->ref, &q->ready);
+    *slot = e->next;
+    if (e->next) {
+        equeue_ptr(q, e->next)->ref = e->ref;
     }
 
-    equeue_mem_dealloc(q, e);
+#if defined(EQUEUE_PRIORITIES)
+    for (unsigned i = 0; i < EQUEUE_PRIORITY_LEVELS; i++) {
+        if (q->levels[i] == &e->next) {
+            q->levels[i] = slot;
+        }
+    }
+    q->tail = q->levels[0];
+#else
+    if (!e->next) {
+        q->tail = slot;
+    }
+#endif
 }
 
 
-// equeue scheduling functions
-static int equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick) {
-    // setup event and hash local id with buffer offset for unique id
-    int id = (e->id << q->npw2) | ((unsigned char *)e - q->buffer);
-    e->target = tick + equeue_clampdiff(e->target, tick);
-    e->generation = q->generation;
+// equeue scheduler, all functions must be called with the queuelock held
+//
+// equeue_sched_insert - Inserts an event into the scheduler, returns true if
+//                       the event is now the earliest pending event
+// equeue_sched_insert_list - Inserts a list of events into the scheduler
+// equeue_sched_remove - Removes a pending event from the scheduler
+// equeue_sched_expire - Removes all events that expire before the target,
+//                       returned as a list of timeslices where each
+//                       timeslice is a list of siblings in reverse order
+// equeue_sched_next   - Finds the target of the earliest pending event,
+//                       returns false if empty, the timing wheel may
+//                       underestimate the target after a cancel
+#if defined(EQUEUE_SCHEDULER_WHEEL)
+// timing wheel geometry, each level covers the bits above the previous level
+static inline unsigned equeue_wheel_shift(int l) {
+    return l ? EQUEUE_WHEEL_BITS0 + (l-1)*EQUEUE_WHEEL_BITSN : 0;
+}
 
-    equeue_mutex_lock(&q->queuelock);
+static inline unsigned equeue_wheel_size(int l) {
+    return l ? 1 << EQUEUE_WHEEL_BITSN : 1 << EQUEUE_WHEEL_BITS0;
+}
 
-    // find the event slot
-    struct equeue_event **p = &q->queue;
-    while (*p && equeue_tickdiff((*p)->target, e->target) < 0) {
-        p = &(*p)->next;
+static inline unsigned equeue_wheel_base(int l) {
+    return l ? (1 << EQUEUE_WHEEL_BITS0) + (l-1)*(1 << EQUEUE_WHEEL_BITSN) : 0;
+}
+
+// find the slot for a target, the level is determined by the highest bit
+// that differs from the wheel's tick, so a slot's targets always share
+// a prefix with the wheel's tick
+static unsigned equeue_wheel_slot(unsigned tick, unsigned target) {
+    int l = 0;
+    while (l < EQUEUE_WHEEL_LEVELS-1 &&
+            ((tick ^ target) >> equeue_wheel_shift(l+1))) {
+        l++;
     }
 
-    // insert at head in slot
-    if (*p && (*p)->target == e->target) {
-        e->next = (*p)->next;
-        if (e->next) {
-            e->next->ref = &e->next;
-        }
-        e->sibling = *p;
-        e->sibling->next = 0;
-        e->sibling->ref = &e->sibling;
-    } else {
-        e->next = *p;
-        if (e->next) {
-            e->next->ref = &e->next;
-        }
+    return equeue_wheel_base(l) +
+            ((target >> equeue_wheel_shift(l)) & (equeue_wheel_size(l)-1));
+}
 
-        e->sibling = 0;
+// push an event onto the head of a list of siblings
+static void equeue_wheel_push(struct equeue_event **p, struct equeue_event *e) {
+    e->next = 0;
+    e->sibling = *p;
+    if (e->sibling) {
+        e->sibling->ref = &e->sibling;
     }
 
     *p = e;
     e->ref = p;
+}
 
-    // notify background timer
-    if ((q->background.update && q->background.active) &&
-        (q->queue == e && !e->sibling)) {
-        q->background.update(q->background.timer,
-                equeue_clampdiff(e->target, tick));
+// slots in higher levels contain multiple timeslices, so they also track
+// their earliest target, this is only a lower bound once the earliest event
+// is removed but becomes exact again when the slot is cascaded
+static void equeue_wheel_insert(equeue_t *q, struct equeue_event *e) {
+    unsigned slot = equeue_wheel_slot(q->wheel.tick, e->target);
+    if (slot >= equeue_wheel_base(1)) {
+        unsigned *min = &q->wheel.mins[slot - equeue_wheel_base(1)];
+        if (!q->wheel.slots[slot] || equeue_tickdiff(e->target, *min) < 0) {
+            *min = e->target;
+        }
     }
 
-    equeue_mutex_unlock(&q->queuelock);
-
-    return id;
+    equeue_wheel_push(&q->wheel.slots[slot], e);
+    q->wheel.map[slot/32] |= 1 << (slot % 32);
 }
 
-static struct equeue_event *equeue_unqueue(equeue_t *q, int id) {
-    // decode event from unique id and check that the local id matches
-    struct equeue_event *e = (struct equeue_event *)
-            &q->buffer[id & ((1 << q->npw2)-1)];
+// find the earliest occupied slot and the earliest tick it may contain
+static bool equeue_wheel_find(equeue_t *q, unsigned *slot, unsigned *start) {
+    unsigned tick = q->wheel.tick;
+    for (int l = 0; l < EQUEUE_WHEEL_LEVELS; l++) {
+        unsigned shift = equeue_wheel_shift(l);
+        unsigned size = equeue_wheel_size(l);
+        unsigned base = equeue_wheel_base(l);
+        unsigned i = (tick >> shift) & (size-1);
+
+        // only the first level contains the current slot, higher levels
+        // hold events that differ from the wheel's tick at that level
+        int found = equeue_bitmap_find(q->wheel.map,
+                base + i + (l ? 1 : 0), base + size);
+        if (found < 0 && l == EQUEUE_WHEEL_LEVELS-1) {
+            // the top level wraps around with the tick
+            found = equeue_bitmap_find(q->wheel.map, base, base + i);
+        }
 
-    equeue_mutex_lock(&q->queuelock);
-    if (e->id != id >> q->npw2) {
-        equeue_mutex_unlock(&q->queuelock);
-        return 0;
+        if (found >= 0) {
+            unsigned mask = (size << shift) - 1;
+            *slot = found;
+            *start = (tick & ~mask) | ((found - base) << shift);
+            return true;
+        }
     }
 
-    // clear the event and check if already in-flight
-    e->cb = 0;
-    e->period = -1;
+    return false;
+}
 
-    int diff = equeue_tickdiff(e->target, q->tick);
-    if (diff < 0 || (diff == 0 && e->generation != q->generation)) {
-        equeue_mutex_unlock(&q->queuelock);
-        return 0;
+// find the earliest target after the earliest event leaves the wheel
+static void equeue_wheel_next(equeue_t *q) {
+    unsigned slot;
+    unsigned start;
+    if (equeue_wheel_find(q, &slot, &start)) {
+        q->wheel.next = (slot >= equeue_wheel_base(1))
+                ? q->wheel.mins[slot - equeue_wheel_base(1)]
+                : start;
     }
+}
 
-    // disentangle from queue
-    if (e->sibling) {
-        e->sibling->next = e->next;
-        if (e->sibling->next) {
-            e->sibling->next->ref = &e->sibling->next;
+// cascade any slots the wheel's tick has moved into down to lower levels
+static void equeue_wheel_cascade(equeue_t *q) {
+    for (int l = EQUEUE_WHEEL_LEVELS-1; l > 0; l--) {
+        unsigned slot = equeue_wheel_base(l) +
+                ((q->wheel.tick >> equeue_wheel_shift(l)) &
+                    (equeue_wheel_size(l)-1));
+        struct equeue_event *es = q->wheel.slots[slot];
+        if (!es) {
+            continue;
         }
 
-        *e->ref = e->sibling;
-        e->sibling->ref = e->ref;
-    } else {
-        *e->ref = e->next;
-        if (e->next) {
-            e->next->ref = e->ref;
-        }
-    }
+        q->wheel.slots[slot] = 0;
+        q->wheel.map[slot/32] &= ~(1 << (slot % 32));
 
-    equeue_incid(q, e);
-    equeue_mutex_unlock(&q->queuelock);
+        // reverse to reinsert in insertion order
+        struct equeue_event *prev = 0;
+        while (es) {
+            struct equeue_event *e = es;
+            es = e->sibling;
+            e->sibling = prev;
+            prev = e;
+        }
 
-    return e;
+        while (prev) {
+            struct equeue_event *e = prev;
+            prev = e->sibling;
+            equeue_wheel_insert(q, e);
+        }
+    }
 }
 
-static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target) {
-    equeue_mutex_lock(&q->queuelock);
+static bool equeue_sched_next(equeue_t *q, unsigned *target) {
+    if (q->queue) {
+        *target = q->queue->target;
+        return true;
+    }
 
-    // find all expired events and mark a new generation
-    q->generation += 1;
-    if (equeue_tickdiff(q->tick, target) <= 0) {
-        q->tick = target;
+    // the earliest target is kept up to date as events come and go
+    if (!q->wheel.count) {
+        return false;
     }
 
-    struct equeue_event *head = q->queue;
-    struct equeue_event **p = &head;
-    while (*p && equeue_tickdiff((*p)->target, target) <= 0) {
-        p = &(*p)->next;
+    *target = q->wheel.next;
+    return true;
+}
+
+static bool equeue_sched_insert(equeue_t *q,
+        struct equeue_event *e, unsigned tick) {
+    // an empty wheel can skip ahead, keeping the wheel's tick recent, but
+    // not past the event being inserted
+    if (!q->wheel.count && equeue_tickdiff(tick, q->wheel.tick) > 0) {
+        if (equeue_tickdiff(e->target, q->wheel.tick) > 0 &&
+                equeue_tickdiff(e->target, tick) < 0) {
+            q->wheel.tick = e->target;
+        } else {
+            q->wheel.tick = tick;
+        }
     }
 
-    q->queue = *p;
-    if (q->queue) {
-        q->queue->ref = &q->queue;
+    unsigned next;
+    bool earliest = !equeue_sched_next(q, &next) ||
+            equeue_tickdiff(e->target, next) < 0;
+
+    if (equeue_tickdiff(e->target, q->wheel.tick) < 0) {
+        // the wheel has already moved past this event, stick it in the
+        // list of expired events to dispatch on the next dequeue
+        equeue_wheel_push(&q->queue, e);
+    } else {
+        equeue_wheel_insert(q, e);
+        if (!q->wheel.count ||
+                equeue_tickdiff(e->target, q->wheel.next) < 0) {
+            q->wheel.next = e->target;
+        }
+        q->wheel.count += 1;
     }
 
-    *p = 0;
+    return earliest;
+}
 
-    equeue_mutex_unlock(&q->queuelock);
+static void equeue_sched_insert_list(equeue_t *q,
+        struct equeue_event *es, unsigned tick) {
+    // inserting in order keeps late events from landing in the list of
+    // expired events out of order
+    es = equeue_list_sort(q, es);
+
+    while (es) {
+        struct equeue_event *e = es;
+        es = e->next;
+        equeue_sched_insert(q, e, tick);
+    }
+}
+
+static void equeue_sched_remove(equeue_t *q, struct equeue_event *e) {
+    *e->ref = e->sibling;
+    if (e->sibling) {
+        e->sibling->ref = e->ref;
+    }
+
+    // events that have not expired are in the slot for their target
+    if (equeue_tickdiff(e->target, q->wheel.tick) >= 0) {
+        unsigned slot = equeue_wheel_slot(q->wheel.tick, e->target);
+        if (!q->wheel.slots[slot]) {
+            q->wheel.map[slot/32] &= ~(1 << (slot % 32));
+        }
+        q->wheel.count -= 1;
+
+        if (e->target == q->wheel.next) {
+            equeue_wheel_next(q);
+        }
+    }
+}
+
+static struct equeue_event *equeue_sched_expire(equeue_t *q, unsigned target) {
+    struct equeue_event *head = 0;
+    struct equeue_event **tail = &head;
+
+    // events that expired while being inserted go first
+    if (q->queue) {
+        *tail = q->queue;
+        tail = &q->queue->next;
+        q->queue = 0;
+    }
+
+    // step through occupied slots, cascading as the wheel's tick moves
+    unsigned slot;
+    unsigned start;
+    while (equeue_wheel_find(q, &slot, &start) &&
+            equeue_tickdiff(start, target) <= 0) {
+        if (slot < equeue_wheel_base(1)) {
+            // slots in the first level contain a single timeslice
+            struct equeue_event *es = q->wheel.slots[slot];
+            q->wheel.slots[slot] = 0;
+            q->wheel.map[slot/32] &= ~(1 << (slot % 32));
+
+            for (struct equeue_event *e = es; e; e = e->sibling) {
+                q->wheel.count -= 1;
+            }
+
+            *tail = es;
+            tail = &es->next;
+            q->wheel.tick = start + 1;
+        } else {
+            q->wheel.tick = start;
+        }
+
+        equeue_wheel_cascade(q);
+    }
+
+    if (equeue_tickdiff(target, q->wheel.tick) >= 0) {
+        q->wheel.tick = target + 1;
+        equeue_wheel_cascade(q);
+    }
+
+    equeue_wheel_next(q);
+
+    *tail = 0;
+    return head;
+}
+#elif defined(EQUEUE_SCHEDULER_HEAP)
+// heap ordering, events with the same target are ordered by insertion
+static inline bool equeue_heap_before(const struct equeue_heap_entry *a,
+        const struct equeue_heap_entry *b) {
+    int diff = equeue_tickdiff(a->target, b->target);
+    return diff < 0 || (diff == 0 && (int)(a->seq - b->seq) < 0);
+}
+
+// the heap's first entry is aligned so the children of each node share a
+// cache line, as long as a node's children fit evenly in a cache line
+#define EQUEUE_HEAP_GROUP (EQUEUE_HEAP_ARITY*sizeof(struct equeue_heap_entry))
+#define EQUEUE_HEAP_ALIGN ((EQUEUE_CACHE_LINE % EQUEUE_HEAP_GROUP == 0) \
+        ? EQUEUE_HEAP_GROUP : sizeof(void*))
+
+// the heap is stored in reverse from the end of the buffer
+static inline struct equeue_heap_entry *equeue_heap_at(equeue_t *q,
+        unsigned i) {
+    return q->heap.entries - i;
+}
+
+// place an entry in the heap, the event's back-reference points to the
+// entry so the event can be found again for cancellation
+static inline void equeue_heap_set(equeue_t *q,
+        unsigned i, struct equeue_heap_entry entry) {
+    *equeue_heap_at(q, i) = entry;
+    entry.e->ref = &equeue_heap_at(q, i)->e;
+}
+
+static inline unsigned equeue_heap_index(equeue_t *q, struct equeue_event *e) {
+    return q->heap.entries - (struct equeue_heap_entry *)(
+            (unsigned char *)e->ref - offsetof(struct equeue_heap_entry, e));
+}
+
+static void equeue_heap_up(equeue_t *q,
+        unsigned i, struct equeue_heap_entry entry) {
+    while (i > 0) {
+        unsigned p = (i-1) / EQUEUE_HEAP_ARITY;
+        if (!equeue_heap_before(&entry, equeue_heap_at(q, p))) {
+            break;
+        }
+
+        equeue_heap_set(q, i, *equeue_heap_at(q, p));
+        i = p;
+    }
+
+    equeue_heap_set(q, i, entry);
+}
+
+static void equeue_heap_down(equeue_t *q,
+        unsigned i, struct equeue_heap_entry entry) {
+    while (EQUEUE_HEAP_ARITY*i + 1 < q->heap.count) {
+        // find the earliest child, children share a cache line
+        unsigned c = EQUEUE_HEAP_ARITY*i + 1;
+        unsigned end = c + EQUEUE_HEAP_ARITY;
+        if (end > q->heap.count) {
+            end = q->heap.count;
+        }
+
+        unsigned min = c;
+        for (unsigned j = c+1; j < end; j++) {
+            if (equeue_heap_before(equeue_heap_at(q, j),
+                    equeue_heap_at(q, min))) {
+                min = j;
+            }
+        }
+
+        if (!equeue_heap_before(equeue_heap_at(q, min), &entry)) {
+            break;
+        }
+
+        equeue_heap_set(q, i, *equeue_heap_at(q, min));
+        i = min;
+    }
+
+    equeue_heap_set(q, i, entry);
+}
+
+static bool equeue_sched_next(equeue_t *q, unsigned *target) {
+    if (q->heap.count) {
+        *target = equeue_heap_at(q, 0)->target;
+        return true;
+    }
+
+    return false;
+}
+
+static bool equeue_sched_insert(equeue_t *q,
+        struct equeue_event *e, unsigned tick) {
+    struct equeue_heap_entry entry = {e->target, q->heap.seq++, e};
+    e->sibling = 0;
+    q->heap.count += 1;
+    equeue_heap_up(q, q->heap.count-1, entry);
+
+    return e->ref == &equeue_heap_at(q, 0)->e;
+}
+
+static void equeue_sched_insert_list(equeue_t *q,
+        struct equeue_event *es, unsigned tick) {
+    while (es) {
+        struct equeue_event *e = es;
+        es = e->next;
+        equeue_sched_insert(q, e, tick);
+    }
+}
+
+static void equeue_sched_remove(equeue_t *q, struct equeue_event *e) {
+    unsigned i = equeue_heap_index(q, e);
+    q->heap.count -= 1;
+    if (i == q->heap.count) {
+        return;
+    }
+
+    // fill the hole with the last entry
+    struct equeue_heap_entry last = *equeue_heap_at(q, q->heap.count);
+    if (i > 0 && equeue_heap_before(&last,
+            equeue_heap_at(q, (i-1) / EQUEUE_HEAP_ARITY))) {
+        equeue_heap_up(q, i, last);
+    } else {
+        equeue_heap_down(q, i, last);
+    }
+}
+
+static struct equeue_event *equeue_sched_expire(equeue_t *q, unsigned target) {
+    struct equeue_event *head = 0;
+    struct equeue_event **tail = &head;
+
+    // events are popped in order, so each timeslice is a single event
+    while (q->heap.count &&
+            equeue_tickdiff(equeue_heap_at(q, 0)->target, target) <= 0) {
+        struct equeue_event *e = equeue_heap_at(q, 0)->e;
+        equeue_sched_remove(q, e);
+
+        e->sibling = 0;
+        *tail = e;
+        tail = &e->next;
+    }
+
+    *tail = 0;
+    return head;
+}
+#else
+static bool equeue_sched_next(equeue_t *q, unsigned *target) {
+    if (q->queue) {
+        *target = equeue_ptr(q, q->queue)->target;
+        return true;
+    }
+
+    return false;
+}
+
+// insert an event into the sorted list, searching for the event's slot
+// from p, returns the slot the event was inserted into
+static equeue_link_t *equeue_list_insert(equeue_t *q,
+        equeue_link_t *p, struct equeue_event *e) {
+    // find the event slot
+    while (*p && equeue_tickdiff(
+            equeue_ptr(q, *p)->target, e->target) < 0) {
+        p = &equeue_ptr(q, *p)->next;
+    }
+
+    // insert at head in slot
+    struct equeue_event *s = equeue_ptr(q, *p);
+    if (s && s->target == e->target) {
+        e->next = s->next;
+        if (e->next) {
+            equeue_ptr(q, e->next)->ref = equeue_ref(q, &e->next, &q->queue);
+        }
+        e->sibling = *p;
+        s->next = 0;
+        s->ref = equeue_ref(q, &e->sibling, &q->queue);
+    } else {
+        e->next = *p;
+        if (e->next) {
+            equeue_ptr(q, e->next)->ref = equeue_ref(q, &e->next, &q->queue);
+        }
+
+        e->sibling = 0;
+    }
+
+    *p = equeue_link(q, e);
+    e->ref = equeue_ref(q, p, &q->queue);
+
+    return p;
+}
+
+static bool equeue_sched_insert(equeue_t *q,
+        struct equeue_event *e, unsigned tick) {
+    equeue_list_insert(q, &q->queue, e);
+    return equeue_ptr(q, q->queue) == e && !e->sibling;
+}
+
+static void equeue_sched_insert_list(equeue_t *q,
+        struct equeue_event *es, unsigned tick) {
+    // sort the events so they can be merged in a single pass
+    es = equeue_list_sort(q, es);
+
+    equeue_link_t *p = &q->queue;
+    while (es) {
+        struct equeue_event *e = es;
+        es = equeue_ptr(q, e->next);
+        p = equeue_list_insert(q, p, e);
+    }
+}
+
+static void equeue_sched_remove(equeue_t *q, struct equeue_event *e) {
+    equeue_link_t *ref = equeue_slot(q, e->ref, &q->queue);
+    struct equeue_event *s = equeue_ptr(q, e->sibling);
+    if (s) {
+        s->next = e->next;
+        if (s->next) {
+            equeue_ptr(q, s->next)->ref = equeue_ref(q, &s->next, &q->queue);
+        }
+
+        *ref = e->sibling;
+        s->ref = e->ref;
+    } else {
+        *ref = e->next;
+        if (e->next) {
+            equeue_ptr(q, e->next)->ref = e->ref;
+        }
+    }
+}
+
+static struct equeue_event *equeue_sched_expire(equeue_t *q, unsigned target) {
+    equeue_link_t head = q->queue;
+    equeue_link_t *p = &head;
+    while (*p && equeue_tickdiff(
+            equeue_ptr(q, *p)->target, target) <= 0) {
+        p = &equeue_ptr(q, *p)->next;
+    }
+
+    q->queue = *p;
+    if (q->queue) {
+        equeue_ptr(q, q->queue)->ref = equeue_ref(q, &q->queue, &q->queue);
+    }
+
+    *p = 0;
+    return equeue_ptr(q, head);
+}
+#endif
+
+
+#if defined(EQUEUE_THREAD_CACHE)
+// each queue gets a unique serial number so threads can tell a cached queue
+// apart from a new queue created at the same address
+static void *volatile equeue_serial;
+
+static unsigned equeue_cache_serial(void) {
+    void *serial;
+    do {
+        serial = equeue_serial;
+    } while (!equeue_atomic_cas(&equeue_serial,
+            serial, (void *)((uintptr_t)serial + 1)));
+
+    return (unsigned)(uintptr_t)serial + 1;
+}
+#endif
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+// size of the bitmap of chunk starts needed to cover a slab
+static inline size_t equeue_mem_mapsize(size_t size) {
+    size_t map = (size/sizeof(void*) + 31)/32 * sizeof(uint32_t);
+    return (map + sizeof(void*)-1) & ~(sizeof(void*)-1);
+}
+#endif
+
+// chunks are aligned to words, or to cache lines so events written by
+// different threads don't share cache lines
+#if defined(EQUEUE_CACHE_ALIGNED)
+#define EQUEUE_MEM_ALIGN EQUEUE_CACHE_LINE
+#else
+#define EQUEUE_MEM_ALIGN sizeof(void*)
+#endif
+
+// allocate a buffer with malloc, or with the platform's page operations if
+// any flags are given, updating size to the size actually allocated
+static void *equeue_buffer_alloc(size_t *size, int flags) {
+#if defined(EQUEUE_PAGES)
+    void *buffer = flags
+            ? equeue_pages_map(size, flags & EQUEUE_CREATE_HUGEPAGES,
+                    flags & EQUEUE_CREATE_LOCKED)
+            : malloc(*size);
+#else
+    void *buffer = malloc(*size);
+#endif
+    if (buffer && (flags & EQUEUE_CREATE_PREFAULT)) {
+        memset(buffer, 0, *size);
+    }
+
+    return buffer;
+}
+
+static void equeue_buffer_free(void *buffer, size_t size, int flags) {
+#if defined(EQUEUE_PAGES)
+    if (flags) {
+        if (buffer) {
+            equeue_pages_unmap(buffer, size);
+        }
+        return;
+    }
+#endif
+    free(buffer);
+}
+
+// equeue lifetime management
+int equeue_create(equeue_t *q, size_t size) {
+    return equeue_create_flags(q, size, 0);
+}
+
+int equeue_create_flags(equeue_t *q, size_t size, int flags) {
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    // the bitmap of chunk starts comes on top of the requested size
+    size += equeue_mem_mapsize(size);
+#endif
+#if defined(EQUEUE_CACHE_ALIGNED)
+    // so does aligning the buffer to a cache line
+    size += EQUEUE_CACHE_LINE - sizeof(void*);
+#endif
+#if defined(EQUEUE_SCHEDULER_HEAP)
+    // and aligning the heap
+    size += EQUEUE_HEAP_ALIGN - sizeof(void*);
+#endif
+
+    // dynamically allocate the specified buffer
+    void *buffer = equeue_buffer_alloc(&size, flags);
+    if (!buffer) {
+        return -1;
+    }
+
+    int err = equeue_create_inplace(q, size, buffer);
+    q->allocated = buffer;
+    q->allocsize = size;
+    q->flags = flags;
+    return err;
+}
+
+int equeue_create_inplace(equeue_t *q, size_t size, void *buffer) {
+    // setup queue around provided buffer
+    // ensure buffer and size are aligned
+    q->buffer = (void *)(((uintptr_t) buffer + EQUEUE_MEM_ALIGN -1)
+            & ~(EQUEUE_MEM_ALIGN -1));
+    size_t align = (char *) q->buffer - (char *) buffer;
+    size = (size > align) ? size - align : 0;
+    size &= ~(sizeof(void *) -1);
+
+    q->allocated = 0;
+    q->allocsize = 0;
+    q->flags = 0;
+    q->allocator = 0;
+    q->allocctx = 0;
+
+#if defined(EQUEUE_COMPACT_EVENTS)
+    // links are 32-bit offsets, so only the first 4GiB can be used
+    if (size > ((UINT32_MAX - sizeof(void*)) & ~(sizeof(void*)-1))) {
+        size = (UINT32_MAX - sizeof(void*)) & ~(sizeof(void*)-1);
+    }
+#endif
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    // the bitmap of chunk starts lives at the end of the buffer, one bit
+    // for each word of what is left
+    size_t map = equeue_mem_mapsize(size);
+    while (map > 0 && equeue_mem_mapsize(size - (map - sizeof(void*)))
+            <= map - sizeof(void*)) {
+        map -= sizeof(void*);
+    }
+    map = (map < size) ? map : size;
+    size -= map;
+    q->starts = (uint32_t *)&q->buffer[size];
+    memset(q->starts, 0, map);
+#endif
+
+    q->npw2 = 0;
+    for (size_t s = size; s; s >>= 1) {
+        q->npw2++;
+    }
+
+#if defined(EQUEUE_GROWABLE)
+    // the original buffer is the first region
+    q->npw2 += EQUEUE_REGION_BITS;
+    q->regions[0].buffer = q->buffer;
+    q->regions[0].size = size;
+    q->regions[0].allocated = 0;
+    q->regions[0].allocsize = 0;
+    q->nregions = 1;
+    q->slabregion = 0;
+#endif
+
+#if defined(EQUEUE_SCHEDULER_HEAP)
+    // the heap grows down from the end of the buffer as chunks are
+    // allocated out of the slab
+    size_t trim = ((uintptr_t)&q->buffer[size]
+            - sizeof(struct equeue_heap_entry)) % EQUEUE_HEAP_ALIGN;
+    size = (size > trim) ? size - trim : 0;
+    q->heap.entries = (struct equeue_heap_entry *)&q->buffer[size] - 1;
+    q->heap.count = 0;
+    q->heap.seq = 0;
+#endif
+
+#if defined(EQUEUE_ALLOCATOR_BINS)
+    memset(q->bins, 0, sizeof(q->bins));
+    memset(q->binmap, 0, sizeof(q->binmap));
+#else
+    q->chunks = 0;
+#endif
+    q->slab.size = size;
+    q->slab.data = q->buffer;
+#if defined(EQUEUE_THREAD_CACHE)
+    q->caches = 0;
+    q->serial = equeue_cache_serial();
+#endif
+#if defined(EQUEUE_POOL)
+    q->pool = 0;
+#endif
+
+    q->queue = 0;
+    equeue_ready_reset(q);
+#if defined(EQUEUE_INTAKE)
+    q->intake = 0;
+#endif
+    q->tick = equeue_tick();
+#if defined(EQUEUE_SCHEDULER_WHEEL)
+    memset(&q->wheel, 0, sizeof(q->wheel));
+    q->wheel.tick = q->tick;
+#endif
+    q->generation = 0;
+    q->break_requested = false;
+#if defined(EQUEUE_WORKERS)
+    q->batch = 0;
+#endif
+
+    q->background.active = false;
+    q->background.update = 0;
+    q->background.timer = 0;
+
+    // initialize platform resources
+    int err;
+    err = equeue_sema_create(&q->eventsema);
+    if (err < 0) {
+        return err;
+    }
+
+    err = equeue_mutex_create(&q->queuelock);
+    if (err < 0) {
+        return err;
+    }
+
+    err = equeue_mutex_create(&q->memlock);
+    if (err < 0) {
+        return err;
+    }
+
+    return 0;
+}
+
+void equeue_destroy(equeue_t *q) {
+    // call destructors on pending events
+    for (struct equeue_event *e = equeue_ptr(q, q->ready); e;
+            e = equeue_ptr(q, e->next)) {
+        equeue_calldtor(e);
+    }
+
+#if defined(EQUEUE_INTAKE)
+    for (struct equeue_event *e = q->intake; e; e = e->next) {
+        equeue_calldtor(e);
+    }
+#endif
+
+    unsigned target;
+    while (equeue_sched_next(q, &target)) {
+        struct equeue_event *ess = equeue_sched_expire(q, target);
+        for (struct equeue_event *es = ess; es;
+                es = equeue_ptr(q, es->next)) {
+            for (struct equeue_event *e = equeue_ptr(q, es->sibling); e;
+                    e = equeue_ptr(q, e->sibling)) {
+                equeue_calldtor(e);
+            }
+            equeue_calldtor(es);
+        }
+    }
+
+    // notify background timer
+    if (q->background.update) {
+        q->background.update(q->background.timer, -1);
+    }
+
+    // clean up platform resources + memory
+    equeue_mutex_destroy(&q->memlock);
+    equeue_mutex_destroy(&q->queuelock);
+    equeue_sema_destroy(&q->eventsema);
+    equeue_buffer_free(q->allocated, q->allocsize, q->flags);
+#if defined(EQUEUE_GROWABLE)
+    for (unsigned i = 1; i < q->nregions; i++) {
+        equeue_buffer_free(q->regions[i].allocated,
+                q->regions[i].allocsize, q->flags);
+    }
+#endif
+}
+
+
+// equeue chunk allocation functions
+static inline size_t equeue_mem_size(size_t size) {
+    // add event overhead
+    size += sizeof(struct equeue_event);
+    size = (size + EQUEUE_MEM_ALIGN-1) & ~(EQUEUE_MEM_ALIGN-1);
+    return size;
+}
+
+#if defined(EQUEUE_ALLOCATOR_BINS)
+// find the size class of a chunk
+static inline unsigned equeue_mem_bin(size_t size) {
+    size_t words = size / sizeof(void*);
+    if (words < EQUEUE_BINS_EXACT) {
+        return words;
+    }
+
+    unsigned bin = EQUEUE_BINS_EXACT;
+    for (words /= EQUEUE_BINS_EXACT; words > 1; words >>= 1) {
+        bin += 1;
+    }
+
+    return bin < EQUEUE_BINS ? bin : EQUEUE_BINS-1;
+}
+
+// pop the first chunk of a size class
+static inline struct equeue_event *equeue_mem_unbin(equeue_t *q, unsigned bin) {
+    struct equeue_event *e = q->bins[bin];
+    q->bins[bin] = e->next;
+    if (!e->next) {
+        q->binmap[bin/32] &= ~((uint32_t)1 << (bin % 32));
+    }
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    if (e->next) {
+        e->next->ref = &q->bins[bin];
+    }
+    e->sibling = 0;
+#endif
+
+    return e;
+}
+#else
+// unlink a chunk from the list of chunks, promoting its sibling if any
+static inline struct equeue_event *equeue_mem_unlink(equeue_t *q,
+        equeue_link_t *p) {
+    struct equeue_event *e = equeue_ptr(q, *p);
+    if (e->sibling) {
+        *p = e->sibling;
+        equeue_ptr(q, *p)->next = e->next;
+    } else {
+        *p = e->next;
+    }
+
+    return e;
+}
+#endif
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+// free chunks are marked by pointing their sibling at the slab, which the
+// scheduler never does, and keep their size in their last word so the
+// following chunk can find them
+#define EQUEUE_MEM_FREE(q) ((struct equeue_event *)&(q)->slab)
+
+static inline unsigned equeue_mem_word(equeue_t *q, struct equeue_event *e) {
+    return ((unsigned char *)e - q->buffer) / sizeof(void*);
+}
+
+static inline bool equeue_mem_isstart(equeue_t *q, struct equeue_event *e) {
+    unsigned i = equeue_mem_word(q, e);
+    return q->starts[i/32] & ((uint32_t)1 << (i % 32));
+}
+
+static inline void equeue_mem_setstart(equeue_t *q,
+        struct equeue_event *e, bool start) {
+    unsigned i = equeue_mem_word(q, e);
+    if (start) {
+        q->starts[i/32] |= (uint32_t)1 << (i % 32);
+    } else {
+        q->starts[i/32] &= ~((uint32_t)1 << (i % 32));
+    }
+}
+
+// remove a free chunk from the middle of its size class
+static void equeue_mem_unfree(equeue_t *q, struct equeue_event *e) {
+    unsigned bin = equeue_mem_bin(e->size);
+    *e->ref = e->next;
+    if (e->next) {
+        e->next->ref = e->ref;
+    }
+
+    if (!q->bins[bin]) {
+        q->binmap[bin/32] &= ~((uint32_t)1 << (bin % 32));
+    }
+    e->sibling = 0;
+}
+
+// absorb the chunk b that follows chunk a
+static void equeue_mem_merge(equeue_t *q,
+        struct equeue_event *a, struct equeue_event *b) {
+    a->size += b->size;
+    b->sibling = 0;
+    equeue_mem_setstart(q, b, false);
+#if defined(EQUEUE_SCHEDULER_HEAP)
+    // one less chunk needs a heap entry
+    q->slab.size += sizeof(struct equeue_heap_entry);
+#endif
+}
+
+static void equeue_mem_release(equeue_t *q, struct equeue_event *e);
+
+// split off the unused end of a chunk
+static void equeue_mem_split(equeue_t *q, struct equeue_event *e, size_t size) {
+    if (e->size - size < sizeof(struct equeue_event)) {
+        return;
+    }
+
+#if defined(EQUEUE_SCHEDULER_HEAP)
+    // the new chunk needs its own heap entry
+    if (q->slab.size < sizeof(struct equeue_heap_entry)) {
+        return;
+    }
+    q->slab.size -= sizeof(struct equeue_heap_entry);
+#endif
+
+    struct equeue_event *rest = (struct equeue_event *)
+            ((unsigned char *)e + size);
+    rest->size = e->size - size;
+    equeue_incid(q, rest);
+    rest->sibling = 0;
+    e->size = size;
+    equeue_mem_setstart(q, rest, true);
+    equeue_mem_release(q, rest);
+}
+#endif
+
+// find a chunk of at least the specified size, must be called with the
+// memlock held
+static struct equeue_event *equeue_mem_chunk(equeue_t *q, size_t size) {
+#if defined(EQUEUE_ALLOCATOR_BINS)
+    // check if a good chunk is available, every chunk in an exact class fits,
+    // shared classes only check their first chunk
+    unsigned bin = equeue_mem_bin(size);
+    if (!q->bins[bin] || q->bins[bin]->size < size) {
+        // otherwise any chunk in a larger class fits
+        int found = equeue_bitmap_find(q->binmap, bin+1, EQUEUE_BINS);
+        bin = (found >= 0) ? (unsigned)found : bin;
+    }
+
+    if (q->bins[bin] && q->bins[bin]->size >= size) {
+        struct equeue_event *e = equeue_mem_unbin(q, bin);
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+        equeue_mem_split(q, e, size);
+#endif
+        return e;
+    }
+#else
+    // check if a good chunk is available
+    for (equeue_link_t *p = &q->chunks; *p;
+            p = &equeue_ptr(q, *p)->next) {
+        if (equeue_ptr(q, *p)->size >= size) {
+            return equeue_mem_unlink(q, p);
+        }
+    }
+#endif
+
+    // otherwise allocate a new chunk out of the slab
+#if defined(EQUEUE_SCHEDULER_HEAP)
+    // each chunk also reserves an entry in the heap at the end of the slab
+    if (q->slab.size >= size + sizeof(struct equeue_heap_entry)) {
+        q->slab.size -= sizeof(struct equeue_heap_entry);
+#else
+    if (q->slab.size >= size) {
+#endif
+        struct equeue_event *e = (struct equeue_event *)q->slab.data;
+        q->slab.data += size;
+        q->slab.size -= size;
+        e->size = size;
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+        // chunks may be carved where a chunk was before, so continue from
+        // whatever id was left there
+        equeue_incid(q, e);
+        e->sibling = 0;
+        equeue_mem_setstart(q, e, true);
+#else
+        e->id = 1;
+#endif
+
+        return e;
+    }
+
+    return 0;
+}
+
+// return a chunk to the free chunks, must be called with the memlock held
+static void equeue_mem_release(equeue_t *q, struct equeue_event *e) {
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    // merge with the following chunk if it is free
+    struct equeue_event *next = (struct equeue_event *)
+            ((unsigned char *)e + e->size);
+    if ((unsigned char *)next < q->slab.data &&
+            next->sibling == EQUEUE_MEM_FREE(q)) {
+        equeue_mem_unfree(q, next);
+        equeue_mem_merge(q, e, next);
+    }
+
+    // merge with the preceding chunk if it is free, the last word before
+    // us is only trusted if it leads to a free chunk that ends here
+    size_t off = (unsigned char *)e - q->buffer;
+    size_t prevsize = off ? ((size_t *)e)[-1] : 0;
+    if (prevsize && prevsize <= off && prevsize % sizeof(void*) == 0) {
+        struct equeue_event *prev = (struct equeue_event *)
+                ((unsigned char *)e - prevsize);
+        if (equeue_mem_isstart(q, prev) &&
+                prev->sibling == EQUEUE_MEM_FREE(q) &&
+                prev->size == prevsize) {
+            equeue_mem_unfree(q, prev);
+            equeue_mem_merge(q, prev, e);
+            e = prev;
+        }
+    }
+
+    // chunks at the end of the slab go back to the slab
+    if ((unsigned char *)e + e->size == q->slab.data) {
+        equeue_mem_setstart(q, e, false);
+        q->slab.data = (unsigned char *)e;
+        q->slab.size += e->size;
+#if defined(EQUEUE_SCHEDULER_HEAP)
+        q->slab.size += sizeof(struct equeue_heap_entry);
+#endif
+        return;
+    }
+
+    e->sibling = EQUEUE_MEM_FREE(q);
+    ((size_t *)((unsigned char *)e + e->size))[-1] = e->size;
+#endif
+
+#if defined(EQUEUE_ALLOCATOR_BINS)
+    // push chunk onto its size class
+    unsigned bin = equeue_mem_bin(e->size);
+    e->next = q->bins[bin];
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    e->ref = &q->bins[bin];
+    if (e->next) {
+        e->next->ref = &e->next;
+    }
+#endif
+    q->bins[bin] = e;
+    q->binmap[bin/32] |= (uint32_t)1 << (bin % 32);
+#else
+    // stick chunk into list of chunks
+    equeue_link_t *p = &q->chunks;
+    while (*p && equeue_ptr(q, *p)->size < e->size) {
+        p = &equeue_ptr(q, *p)->next;
+    }
+
+    struct equeue_event *s = equeue_ptr(q, *p);
+    if (s && s->size == e->size) {
+        e->sibling = *p;
+        e->next = s->next;
+    } else {
+        e->sibling = 0;
+        e->next = *p;
+    }
+    *p = equeue_link(q, e);
+#endif
+}
+
+#if defined(EQUEUE_POOL)
+// the pool holds chunks of the size allocated by equeue_call
+#define EQUEUE_POOL_SIZE equeue_mem_size(2*sizeof(void*))
+
+// the pool's head packs the offset of the top chunk with a tag that changes
+// on every update, so a head that was popped and pushed back while another
+// thread was looking at it fails that thread's compare-and-swap
+static inline void *equeue_pool_pack(equeue_t *q,
+        struct equeue_event *e, uintptr_t tag) {
+    uintptr_t off = e ? equeue_offset(q, e)/sizeof(void*) + 1 : 0;
+    return (void *)(off | (tag << q->npw2));
+}
+
+static inline struct equeue_event *equeue_pool_chunk(equeue_t *q, void *head) {
+    uintptr_t off = (uintptr_t)head & (((uintptr_t)1 << q->npw2) - 1);
+    return off ? equeue_at(q, (off-1)*sizeof(void*)) : 0;
+}
+
+static inline uintptr_t equeue_pool_tag(equeue_t *q, void *head) {
+    return (uintptr_t)head >> q->npw2;
+}
+
+static struct equeue_event *equeue_pool_pop(equeue_t *q) {
+    while (true) {
+        void *head = q->pool;
+        struct equeue_event *e = equeue_pool_chunk(q, head);
+        if (!e) {
+            return 0;
+        }
+
+        // the chunk may be popped by another thread before our
+        // compare-and-swap, but then the tag has changed
+        void *next = equeue_pool_pack(q, e->next,
+                equeue_pool_tag(q, head) + 1);
+        if (equeue_atomic_cas(&q->pool, head, next)) {
+            return e;
+        }
+    }
+}
+
+static void equeue_pool_push(equeue_t *q, struct equeue_event *e) {
+    while (true) {
+        void *head = q->pool;
+        e->next = equeue_pool_chunk(q, head);
+        if (equeue_atomic_cas(&q->pool, head,
+                equeue_pool_pack(q, e, equeue_pool_tag(q, head) + 1))) {
+            return;
+        }
+    }
+}
+
+// return all pooled chunks to the allocator, must be called with the
+// memlock held
+static bool equeue_pool_drain(equeue_t *q) {
+    void *head;
+    do {
+        head = q->pool;
+    } while (!equeue_atomic_cas(&q->pool, head,
+            equeue_pool_pack(q, 0, equeue_pool_tag(q, head) + 1)));
+
+    struct equeue_event *e = equeue_pool_chunk(q, head);
+    if (!e) {
+        return false;
+    }
+
+    while (e) {
+        struct equeue_event *next = e->next;
+        equeue_mem_release(q, e);
+        e = next;
+    }
+
+    return true;
+}
+#endif
+
+#if defined(EQUEUE_THREAD_CACHE)
+// this thread's most recently used cache
+static EQUEUE_THREAD_LOCAL struct {
+    equeue_t *q;
+    unsigned serial;
+    struct equeue_cache *cache;
+} equeue_thread;
+
+// return all chunks in this thread's cache to the allocator, other threads'
+// caches can't be touched, must be called with the memlock held
+static bool equeue_cache_drain(equeue_t *q) {
+    if (equeue_thread.q != q || equeue_thread.serial != q->serial) {
+        return false;
+    }
+
+    bool drained = false;
+    struct equeue_cache *c = equeue_thread.cache;
+    for (int i = 0; i < EQUEUE_CACHE_CLASSES; i++) {
+        while (c->classes[i].chunks) {
+            struct equeue_event *e = c->classes[i].chunks;
+            c->classes[i].chunks = e->next;
+            equeue_mem_release(q, e);
+            drained = true;
+        }
+        c->classes[i].count = 0;
+    }
+
+    return drained;
+}
+#endif
+
+#if defined(EQUEUE_GROWABLE)
+// attach memory as new regions, splitting it if it is larger than a region
+// can be, must be called with the memlock held
+static int equeue_mem_attach(equeue_t *q,
+        size_t size, void *buffer, void *allocated) {
+    size_t allocsize = size;
+    unsigned char *data = (unsigned char *)(((uintptr_t)buffer
+            + EQUEUE_MEM_ALIGN-1) & ~(EQUEUE_MEM_ALIGN-1));
+    size_t align = data - (unsigned char *)buffer;
+    size = (size > align) ? (size - align) & ~(sizeof(void*)-1) : 0;
+    size_t limit = (size_t)1 << (q->npw2 - EQUEUE_REGION_BITS);
+
+    int err = -1;
+    while (size >= sizeof(struct equeue_event) &&
+            q->nregions < EQUEUE_REGIONS) {
+        struct equeue_region *r = &q->regions[q->nregions];
+        r->buffer = data;
+        r->size = (size < limit) ? size : limit;
+        r->allocated = allocated;
+        r->allocsize = allocated ? allocsize : 0;
+        allocated = 0;
+        if (q->allocator) {
+            q->allocator->attach(q->allocctx, r->buffer, r->size);
+        }
+
+        data += r->size;
+        size -= r->size;
+        q->nregions += 1;
+        err = 0;
+    }
+
+    return err;
+}
+
+// attach a new region to queues created with equeue_create, allocated the
+// same way as their buffer, must be called with the memlock held
+static bool equeue_mem_expand(equeue_t *q, size_t size) {
+    if (!q->allocated || size > q->regions[0].size) {
+        return false;
+    }
+
+    size_t rsize = q->regions[0].size;
+    void *buffer = equeue_buffer_alloc(&rsize, q->flags);
+    if (!buffer) {
+        return false;
+    }
+
+    if (equeue_mem_attach(q, rsize, buffer, buffer) < 0) {
+        equeue_buffer_free(buffer, rsize, q->flags);
+        return false;
+    }
+
+    return true;
+}
+
+// move the slab to the next unused region, returning what's left of the
+// current slab to the allocator, or expand the queue if there are no regions
+// left, regions too small for the size are passed over on the next call,
+// must be called with the memlock held
+static bool equeue_mem_grow(equeue_t *q, size_t size) {
+    if (q->slabregion+1 >= q->nregions && !equeue_mem_expand(q, size)) {
+        return false;
+    }
+
+    if (q->slab.size >= sizeof(struct equeue_event)) {
+        struct equeue_event *e = (struct equeue_event *)q->slab.data;
+        e->size = q->slab.size;
+        e->id = 1;
+        equeue_mem_release(q, e);
+    }
+
+    q->slabregion += 1;
+    q->slab.data = q->regions[q->slabregion].buffer;
+    q->slab.size = q->regions[q->slabregion].size;
+    return true;
+}
+#endif
+
+// find a chunk of at least the specified size, returning pooled and cached
+// chunks to the allocator or growing the queue if we run out of memory, must
+// be called with the memlock held
+static struct equeue_event *equeue_mem_take(equeue_t *q, size_t size) {
+    struct equeue_event *e = equeue_mem_chunk(q, size);
+#if defined(EQUEUE_POOL)
+    if (!e && equeue_pool_drain(q)) {
+        e = equeue_mem_chunk(q, size);
+    }
+#endif
+#if defined(EQUEUE_THREAD_CACHE)
+    if (!e && equeue_cache_drain(q)) {
+        e = equeue_mem_chunk(q, size);
+    }
+#endif
+#if defined(EQUEUE_GROWABLE)
+    while (!e && equeue_mem_grow(q, size)) {
+        e = equeue_mem_chunk(q, size);
+    }
+#endif
+
+    return e;
+}
+
+#if defined(EQUEUE_THREAD_CACHE)
+// find a free chunk of exactly the specified size without touching the slab,
+// must be called with the memlock held
+static struct equeue_event *equeue_mem_exact(equeue_t *q, size_t size) {
+#if defined(EQUEUE_ALLOCATOR_BINS)
+    unsigned bin = equeue_mem_bin(size);
+    if (q->bins[bin] && q->bins[bin]->size == size) {
+        return equeue_mem_unbin(q, bin);
+    }
+#else
+    for (struct equeue_event **p = &q->chunks; *p; p = &(*p)->next) {
+        if ((*p)->size >= size) {
+            return (*p)->size == size ? equeue_mem_unlink(q, p) : 0;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static struct equeue_cache *equeue_cache_get(equeue_t *q) {
+    if (equeue_thread.q == q && equeue_thread.serial == q->serial) {
+        return equeue_thread.cache;
+    }
+
+    // find or create this thread's cache, a new thread may adopt the cache
+    // of an exited thread that had the same thread-local storage
+    equeue_mutex_lock(&q->memlock);
+    struct equeue_cache *c = q->caches;
+    while (c && c->owner != &equeue_thread) {
+        c = c->next;
+    }
+
+    if (!c) {
+        struct equeue_event *e = equeue_mem_take(q,
+                equeue_mem_size(sizeof(struct equeue_cache)));
+        if (e) {
+            c = (struct equeue_cache *)(e + 1);
+            memset(c, 0, sizeof(struct equeue_cache));
+            c->owner = &equeue_thread;
+            c->next = q->caches;
+            q->caches = c;
+        }
+    }
+    equeue_mutex_unlock(&q->memlock);
+
+    if (c) {
+        equeue_thread.q = q;
+        equeue_thread.serial = q->serial;
+        equeue_thread.cache = c;
+    }
+
+    return c;
+}
+
+// find the class for a size, claiming an empty class if needed
+static struct equeue_cache_class *equeue_cache_class(
+        struct equeue_cache *c, unsigned size) {
+    struct equeue_cache_class *empty = 0;
+    for (int i = 0; i < EQUEUE_CACHE_CLASSES; i++) {
+        if (c->classes[i].size == size) {
+            return &c->classes[i];
+        } else if (!empty && !c->classes[i].count) {
+            empty = &c->classes[i];
+        }
+    }
+
+    if (empty) {
+        empty->size = size;
+    }
+
+    return empty;
+}
+
+static struct equeue_event *equeue_cache_alloc(equeue_t *q,
+        struct equeue_cache *c, size_t size) {
+    struct equeue_cache_class *k = equeue_cache_class(c, size);
+    if (k && k->chunks) {
+        struct equeue_event *e = k->chunks;
+        k->chunks = e->next;
+        k->count -= 1;
+        c->hits += 1;
+        return e;
+    }
+
+    // on a miss, refill the class with up to half a limit of free chunks
+    c->misses += 1;
+    equeue_mutex_lock(&q->memlock);
+    struct equeue_event *e = equeue_mem_take(q, size);
+    while (e && k && k->count < EQUEUE_CACHE_LIMIT/2) {
+        struct equeue_event *f = equeue_mem_exact(q, size);
+        if (!f) {
+            break;
+        }
+
+        f->next = k->chunks;
+        k->chunks = f;
+        k->count += 1;
+    }
+    equeue_mutex_unlock(&q->memlock);
+
+    return e;
+}
+
+static bool equeue_cache_dealloc(equeue_t *q,
+        struct equeue_cache *c, struct equeue_event *e) {
+    struct equeue_cache_class *k = equeue_cache_class(c, e->size);
+    if (!k) {
+        return false;
+    }
+
+    e->next = k->chunks;
+    k->chunks = e;
+    k->count += 1;
+
+    // once full, flush half of the class back to the queue
+    if (k->count >= EQUEUE_CACHE_LIMIT) {
+        c->flushes += 1;
+        equeue_mutex_lock(&q->memlock);
+        while (k->count > EQUEUE_CACHE_LIMIT/2) {
+            struct equeue_event *f = k->chunks;
+            k->chunks = f->next;
+            k->count -= 1;
+            equeue_mem_release(q, f);
+        }
+        equeue_mutex_unlock(&q->memlock);
+    }
+
+    return true;
+}
+#endif
+
+// allocate and free chunks with a pluggable allocator, growable queues
+// are expanded when the allocator runs out of memory
+static struct equeue_event *equeue_plug_alloc(equeue_t *q, size_t size) {
+    const equeue_allocator_t *a = q->allocator;
+    bool locked = !(a->flags & EQUEUE_ALLOCATOR_LOCKFREE);
+    if (locked) {
+        equeue_mutex_lock(&q->memlock);
+    }
+
+    struct equeue_event *e = a->alloc(q->allocctx, size);
+#if defined(EQUEUE_GROWABLE)
+    if (!e) {
+        if (!locked) {
+            equeue_mutex_lock(&q->memlock);
+        }
+
+        while (!e && equeue_mem_expand(q, size)) {
+            e = a->alloc(q->allocctx, size);
+        }
+
+        if (!locked) {
+            equeue_mutex_unlock(&q->memlock);
+        }
+    }
+#endif
+
+    if (locked) {
+        equeue_mutex_unlock(&q->memlock);
+    }
+
+    if (!e) {
+        return 0;
+    }
+
+    // reused chunks continue from the id left in their header, fresh memory
+    // may hold any id as long as it doesn't encode to 0
+    e->size = a->size ? a->size(q->allocctx, e) : size;
+    if (!equeue_id(q, e)) {
+        e->id = 1;
+    }
+
+    return e;
+}
+
+static void equeue_plug_dealloc(equeue_t *q, struct equeue_event *e) {
+    const equeue_allocator_t *a = q->allocator;
+    if (a->flags & EQUEUE_ALLOCATOR_LOCKFREE) {
+        a->dealloc(q->allocctx, e, e->size);
+    } else {
+        equeue_mutex_lock(&q->memlock);
+        a->dealloc(q->allocctx, e, e->size);
+        equeue_mutex_unlock(&q->memlock);
+    }
+}
+
+static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size) {
+    size = equeue_mem_size(size);
+
+    if (q->allocator) {
+        return equeue_plug_alloc(q, size);
+    }
+
+#if defined(EQUEUE_POOL)
+    if (size == EQUEUE_POOL_SIZE) {
+        struct equeue_event *e = equeue_pool_pop(q);
+        if (e) {
+            return e;
+        }
+    }
+#endif
+
+#if defined(EQUEUE_THREAD_CACHE)
+    struct equeue_cache *c = equeue_cache_get(q);
+    if (c) {
+        return equeue_cache_alloc(q, c, size);
+    }
+#endif
+
+    equeue_mutex_lock(&q->memlock);
+    struct equeue_event *e = equeue_mem_take(q, size);
+    equeue_mutex_unlock(&q->memlock);
+
+    return e;
+}
+
+static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e) {
+    if (q->allocator) {
+        equeue_plug_dealloc(q, e);
+        return;
+    }
+
+#if defined(EQUEUE_POOL)
+    if (e->size == EQUEUE_POOL_SIZE) {
+        equeue_pool_push(q, e);
+        return;
+    }
+#endif
+
+#if defined(EQUEUE_THREAD_CACHE)
+    struct equeue_cache *c = equeue_cache_get(q);
+    if (c && equeue_cache_dealloc(q, c, e)) {
+        return;
+    }
+#endif
+
+    equeue_mutex_lock(&q->memlock);
+    equeue_mem_release(q, e);
+    equeue_mutex_unlock(&q->memlock);
+}
+
+// reset a newly allocated event, compact events only get an extension if
+// space was reserved for it
+static inline void equeue_event_setup(struct equeue_event *e, bool ext) {
+    e->target = 0;
+    e->slack = 0;
+#if defined(EQUEUE_COMPACT_EVENTS)
+    if (ext) {
+        e->slack = EQUEUE_SLACK_EXT;
+        equeue_ext(e)->period = -1;
+        equeue_ext(e)->dtor = 0;
+    }
+#else
+    e->period = -1;
+    e->dtor = 0;
+#endif
+}
+
+static void *equeue_alloc_ext(equeue_t *q, size_t size, bool ext) {
+#if defined(EQUEUE_COMPACT_EVENTS)
+    if (ext) {
+        size += sizeof(struct equeue_event_ext);
+    }
+#endif
+
+    struct equeue_event *e = equeue_mem_alloc(q, size);
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_setup(e, ext);
+    return e + 1;
+}
+
+void *equeue_alloc(equeue_t *q, size_t size) {
+    return equeue_alloc_ext(q, size, true);
+}
+
+int equeue_alloc_batch(equeue_t *q, size_t size, void **events, int count) {
+#if defined(EQUEUE_COMPACT_EVENTS)
+    size += sizeof(struct equeue_event_ext);
+#endif
+    size = equeue_mem_size(size);
+
+    int i = 0;
+    if (q->allocator) {
+        for (; i < count; i++) {
+            struct equeue_event *e = equeue_plug_alloc(q, size);
+            if (!e) {
+                break;
+            }
+
+            events[i] = e + 1;
+        }
+    } else {
+        equeue_mutex_lock(&q->memlock);
+        for (; i < count; i++) {
+#if defined(EQUEUE_POOL)
+            struct equeue_event *e = (size == EQUEUE_POOL_SIZE)
+                    ? equeue_pool_pop(q) : 0;
+            e = e ? e : equeue_mem_take(q, size);
+#else
+            struct equeue_event *e = equeue_mem_take(q, size);
+#endif
+            if (!e) {
+                break;
+            }
+
+            events[i] = e + 1;
+        }
+        equeue_mutex_unlock(&q->memlock);
+    }
+
+    for (int j = 0; j < i; j++) {
+        equeue_event_setup((struct equeue_event*)events[j] - 1, true);
+    }
+
+    return i;
+}
+
+void equeue_dealloc(equeue_t *q, void *p) {
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    equeue_calldtor(e);
+    equeue_mem_dealloc(q, e);
+}
+
+int equeue_allocator(equeue_t *q,
+        const equeue_allocator_t *allocator, void *ctx) {
+#if defined(EQUEUE_SCHEDULER_HEAP) || defined(EQUEUE_ALLOCATOR_COALESCE)
+    // the heap and the bitmap of chunk starts are tied to the built-in
+    // allocator's chunks
+    return -1;
+#else
+    // only untouched memory can be handed over, any chunks already carved
+    // out of the slab belong to the built-in allocator
+    equeue_mutex_lock(&q->memlock);
+#if defined(EQUEUE_GROWABLE)
+    bool used = q->slabregion != 0 || q->slab.data != q->buffer;
+#else
+    bool used = q->slab.data != q->buffer;
+#endif
+    if (used || q->allocator) {
+        equeue_mutex_unlock(&q->memlock);
+        return -1;
+    }
+
+    q->allocator = allocator;
+    q->allocctx = ctx;
+    allocator->attach(ctx, q->slab.data, q->slab.size);
+#if defined(EQUEUE_GROWABLE)
+    for (unsigned i = 1; i < q->nregions; i++) {
+        allocator->attach(ctx, q->regions[i].buffer, q->regions[i].size);
+    }
+#endif
+    q->slab.size = 0;
+    equeue_mutex_unlock(&q->memlock);
+
+    return 0;
+#endif
+}
+
+int equeue_extend(equeue_t *q, size_t size, void *buffer) {
+#if defined(EQUEUE_GROWABLE)
+    // dynamically allocate the region if no buffer is provided
+    void *allocated = 0;
+    if (!buffer) {
+        buffer = allocated = equeue_buffer_alloc(&size, q->flags);
+        if (!buffer) {
+            return -1;
+        }
+    }
+
+    equeue_mutex_lock(&q->memlock);
+    int err = equeue_mem_attach(q, size, buffer, allocated);
+    equeue_mutex_unlock(&q->memlock);
+
+    if (err < 0) {
+        equeue_buffer_free(allocated, size, q->flags);
+    }
+
+    return err;
+#else
+    return -1;
+#endif
+}
+
+
+// equeue scheduling functions
+static bool equeue_next(equeue_t *q, unsigned *target) {
+#if defined(EQUEUE_INTAKE)
+    if (q->ready || q->intake) {
+        *target = q->tick;
+        return true;
+    }
+#else
+    if (q->ready) {
+        *target = equeue_ptr(q, q->ready)->target;
+        return true;
+    }
+#endif
+
+    return equeue_sched_next(q, target);
+}
+
+#if !defined(EQUEUE_INTAKE)
+static equeue_id64_t equeue_enqueue_ready(equeue_t *q,
+        struct equeue_event *e) {
+    // setup event and hash local id with buffer offset for unique id
+    equeue_id64_t id = equeue_id64(q, e);
+    e->next = 0;
+    // ready events are marked with a self-referencing sibling
+    e->sibling = equeue_link(q, e);
+
+    equeue_mutex_lock(&q->queuelock);
+
+    // ready events expire at the last dispatched tick, avoiding a read
+    // of the tick while still looking pending to equeue_unqueue
+    e->target = q->tick;
+    e->generation = q->generation;
+
+    // append to ready list and notify background timer
+    equeue_ready_push(q, e);
+
+    if ((q->background.update && q->background.active) &&
+        (equeue_ptr(q, q->ready) == e)) {
+        q->background.update(q->background.timer, 0);
+    }
+
+    equeue_mutex_unlock(&q->queuelock);
+
+    return id;
+}
+#endif
+
+static equeue_id64_t equeue_enqueue(equeue_t *q,
+        struct equeue_event *e, unsigned tick) {
+    // setup event and hash local id with buffer offset for unique id
+    equeue_id64_t id = equeue_id64(q, e);
+    e->target = tick + equeue_clampdiff(e->target, tick);
+    e->target = equeue_slack(e->target, e->slack & EQUEUE_SLACK_MASK);
+    e->generation = q->generation;
+
+    equeue_mutex_lock(&q->queuelock);
+
+    // insert into the scheduler and notify background timer
+    if (equeue_sched_insert(q, e, tick) && !q->ready &&
+        (q->background.update && q->background.active)) {
+        q->background.update(q->background.timer,
+                equeue_tick2ms(equeue_clampdiff(e->target, tick)));
+    }
+
+    equeue_mutex_unlock(&q->queuelock);
+
+    return id;
+}
+
+#if defined(EQUEUE_INTAKE)
+// move events from the intake into the scheduler, must be called with the
+// queuelock held before a new generation is marked
+static void equeue_intake_splice(equeue_t *q, unsigned tick) {
+    struct equeue_event *es = equeue_atomic_swap(
+            (void *volatile *)&q->intake, 0);
+
+    // the intake is a stack, reverse to match posting order
+    struct equeue_event *prev = 0;
+    while (es) {
+        struct equeue_event *e = es;
+        es = e->next;
+        e->next = prev;
+        prev = e;
+    }
+
+    // append ready events to the ready list and merge timers into the
+    // scheduler all at once
+    struct equeue_event *delayed = 0;
+    struct equeue_event **dtail = &delayed;
+    while (prev) {
+        struct equeue_event *e = prev;
+        prev = e->next;
+
+        e->generation = q->generation;
+        if (e->sibling == e) {
+            e->target = q->tick;
+            equeue_ready_push(q, e);
+        } else {
+            *dtail = e;
+            dtail = &e->next;
+        }
+    }
+
+    *dtail = 0;
+    equeue_sched_insert_list(q, delayed, tick);
+}
+
+static void equeue_intake_push(equeue_t *q,
+        struct equeue_event *head, struct equeue_event *tail) {
+    struct equeue_event *prev;
+    do {
+        prev = q->intake;
+        tail->next = prev;
+    } while (!equeue_atomic_cas((void *volatile *)&q->intake, prev, head));
+
+    // the background timer can't see into the intake, so backgrounded
+    // queues splice the intake immediately
+    if (q->background.update) {
+        equeue_mutex_lock(&q->queuelock);
+        unsigned tick = equeue_tick();
+        equeue_intake_splice(q, tick);
+
+        unsigned target;
+        if ((q->background.update && q->background.active) &&
+                equeue_next(q, &target)) {
+            q->background.update(q->background.timer,
+                    equeue_tick2ms(equeue_clampdiff(target, tick)));
+        }
+        equeue_mutex_unlock(&q->queuelock);
+    }
+}
+#endif
+
+// decode an event from an id or handle and check that the local id matches,
+// int ids only hold the bottom bits of the handle, if chunks are coalesced
+// the event may have been merged into another chunk, in which case its
+// header can't be trusted, must be called with the queuelock held, the
+// memlock is taken inside it since checking first would let the chunk be
+// merged before the queuelock is taken
+static struct equeue_event *equeue_decode(equeue_t *q,
+        equeue_id64_t id, bool wide) {
+    struct equeue_event *e = equeue_at(q,
+            id & (((equeue_id64_t)1 << q->npw2) - 1));
+    if (!e) {
+        return 0;
+    }
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    equeue_mutex_lock(&q->memlock);
+    bool match = (unsigned char *)e < q->slab.data &&
+            equeue_mem_isstart(q, e) && (wide ? equeue_id64(q, e) :
+            (uint32_t)equeue_id64(q, e)) == id;
+    equeue_mutex_unlock(&q->memlock);
+#else
+    bool match = (wide ? equeue_id64(q, e) :
+            (uint32_t)equeue_id64(q, e)) == id;
+#endif
+
+    return match ? e : 0;
+}
+
+static struct equeue_event *equeue_unqueue(equeue_t *q,
+        equeue_id64_t id, bool wide) {
+    // decode event from unique id and check that the local id matches
+    equeue_mutex_lock(&q->queuelock);
+    struct equeue_event *e = equeue_decode(q, id, wide);
+    if (!e) {
+        equeue_mutex_unlock(&q->queuelock);
+        return 0;
+    }
+
+    // clear the event and check if already in-flight
+    e->cb = 0;
+    equeue_setperiod(e, -1);
+
+#if defined(EQUEUE_INTAKE)
+    // events still in the intake are cleaned up by the dispatch loop
+    if (!e->ref) {
+        equeue_mutex_unlock(&q->queuelock);
+        return 0;
+    }
+#endif
+
+    int diff = equeue_tickdiff(e->target, q->tick);
+    if (diff < 0 || (diff == 0 && e->generation != q->generation)) {
+        equeue_mutex_unlock(&q->queuelock);
+        return 0;
+    }
+
+    // disentangle from queue
+    if (equeue_ptr(q, e->sibling) == e) {
+        equeue_ready_remove(q, e);
+    } else {
+        equeue_sched_remove(q, e);
+    }
+
+    equeue_incid(q, e);
+    equeue_mutex_unlock(&q->queuelock);
+
+    return e;
+}
+
+static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target) {
+    equeue_mutex_lock(&q->queuelock);
+
+#if defined(EQUEUE_INTAKE)
+    // pick up any events posted through the intake
+    equeue_intake_splice(q, target);
+#endif
+
+    // find all expired events and mark a new generation
+    q->generation += 1;
+    if (equeue_tickdiff(q->tick, target) <= 0) {
+        q->tick = target;
+    }
+
+    equeue_link_t head = equeue_link(q, equeue_sched_expire(q, target));
+
+    // and all ready events
+    equeue_link_t ready = q->ready;
+    equeue_ready_reset(q);
+
+    equeue_mutex_unlock(&q->queuelock);
+
+    // reverse and flatten each slot to match insertion order
+    equeue_link_t *tail = &head;
+    struct equeue_event *ess = equeue_ptr(q, head);
+    while (ess) {
+        struct equeue_event *es = ess;
+        ess = equeue_ptr(q, es->next);
+
+        equeue_link_t prev = 0;
+        for (struct equeue_event *e = es; e; e = equeue_ptr(q, e->sibling)) {
+            e->next = prev;
+            prev = equeue_link(q, e);
+        }
+
+        *tail = prev;
+        tail = &es->next;
+    }
+
+    // ready events are already in insertion order
+    *tail = ready;
+
+#if defined(EQUEUE_PRIORITIES)
+    // stable partition by priority so higher priorities run first
+    equeue_link_t heads[EQUEUE_PRIORITY_LEVELS];
+    equeue_link_t *tails[EQUEUE_PRIORITY_LEVELS];
+    for (unsigned i = 0; i < EQUEUE_PRIORITY_LEVELS; i++) {
+        heads[i] = 0;
+        tails[i] = &heads[i];
+    }
+
+    struct equeue_event *es = equeue_ptr(q, head);
+    while (es) {
+        struct equeue_event *e = es;
+        es = equeue_ptr(q, e->next);
+        unsigned p = equeue_priority(e);
+        *tails[p] = equeue_link(q, e);
+        tails[p] = &e->next;
+    }
+
+    head = 0;
+    for (unsigned i = 0; i < EQUEUE_PRIORITY_LEVELS; i++) {
+        *tails[i] = head;
+        head = heads[i];
+    }
+#endif
+
+    return equeue_ptr(q, head);
+}
+
+#if defined(EQUEUE_PRIORITIES)
+// take the first ready event if it has a higher priority than the given
+// priority, marking it with an older generation so it looks in-flight to
+// equeue_unqueue like the rest of the dequeued events
+static struct equeue_event *equeue_preempt(equeue_t *q,
+        unsigned priority, unsigned tick) {
+#if defined(EQUEUE_INTAKE)
+    if (!q->ready && !q->intake) {
+        return 0;
+    }
+
+    equeue_mutex_lock(&q->queuelock);
+    equeue_intake_splice(q, tick);
+#else
+    if (!q->ready) {
+        return 0;
+    }
+
+    equeue_mutex_lock(&q->queuelock);
+#endif
+    struct equeue_event *e = equeue_ptr(q, q->ready);
+    if (e && equeue_priority(e) > priority) {
+        equeue_ready_remove(q, e);
+        e->next = 0;
+        e->generation = q->generation - 1;
+    } else {
+        e = 0;
+    }
+    equeue_mutex_unlock(&q->queuelock);
+
+    return e;
+}
+#endif
+
+equeue_id64_t equeue_post_id64(equeue_t *q, void (*cb)(void*), void *p) {
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    e->cb = cb;
+
+#if defined(EQUEUE_INTAKE)
+    // push onto the intake, timers still need an absolute target as the
+    // dispatch loop may splice the intake much later
+    equeue_id64_t id = equeue_id64(q, e);
+    e->ref = 0;
+    if ((int)e->target <= 0) {
+        e->sibling = e;
+    } else {
+        e->target = equeue_slack(equeue_tick() + e->target,
+                e->slack & EQUEUE_SLACK_MASK);
+        e->sibling = 0;
+    }
+
+    equeue_intake_push(q, e, e);
+#else
+    // events without delays skip the scheduler
+    equeue_id64_t id;
+    if ((int)e->target <= 0) {
+        id = equeue_enqueue_ready(q, e);
+    } else {
+        unsigned tick = equeue_tick();
+        e->target = tick + e->target;
+        id = equeue_enqueue(q, e, tick);
+    }
+#endif
+
+    equeue_sema_signal(&q->eventsema);
+    return id;
+}
+
+int equeue_post(equeue_t *q, void (*cb)(void*), void *p) {
+    return (int)(uint32_t)equeue_post_id64(q, cb, p);
+}
+
+void equeue_post_batch(equeue_t *q, void (*cb)(void*),
+        void **events, int *ids, int count) {
+#if defined(EQUEUE_INTAKE)
+    // push the whole batch onto the intake at once, last event first
+    struct equeue_event *head = 0;
+    struct equeue_event *tail = 0;
+    unsigned tick = 0;
+    bool ticked = false;
+
+    for (int i = 0; i < count; i++) {
+        struct equeue_event *e = (struct equeue_event*)events[i] - 1;
+        e->cb = cb;
+        if (ids) {
+            ids[i] = equeue_id(q, e);
+        }
+
+        e->ref = 0;
+        if ((int)e->target <= 0) {
+            e->sibling = e;
+        } else {
+            if (!ticked) {
+                tick = equeue_tick();
+                ticked = true;
+            }
+
+            e->target = equeue_slack(tick + e->target,
+                    e->slack & EQUEUE_SLACK_MASK);
+            e->sibling = 0;
+        }
+
+        e->next = head;
+        head = e;
+        if (!tail) {
+            tail = e;
+        }
+    }
+
+    if (head) {
+        equeue_intake_push(q, head, tail);
+    }
+#else
+    // split into ready and delayed events, only reading the tick if needed
+    equeue_link_t ready = 0;
+    equeue_link_t *rtail = &ready;
+    equeue_link_t delayed = 0;
+    equeue_link_t *dtail = &delayed;
+    unsigned tick = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct equeue_event *e = (struct equeue_event*)events[i] - 1;
+        e->cb = cb;
+        if (ids) {
+            ids[i] = equeue_id(q, e);
+        }
+
+        if ((int)e->target <= 0) {
+            e->sibling = equeue_link(q, e);
+            *rtail = equeue_link(q, e);
+            rtail = &e->next;
+        } else {
+            if (!delayed) {
+                tick = equeue_tick();
+            }
+
+            e->target = equeue_slack(tick + e->target,
+                    e->slack & EQUEUE_SLACK_MASK);
+            *dtail = equeue_link(q, e);
+            dtail = &e->next;
+        }
+    }
+
+    *rtail = 0;
+    *dtail = 0;
+
+    equeue_mutex_lock(&q->queuelock);
+    unsigned prev;
+    bool pending = equeue_next(q, &prev);
+
+    // append ready events to the ready list
+    struct equeue_event *es = equeue_ptr(q, ready);
+    while (es) {
+        struct equeue_event *e = es;
+        es = equeue_ptr(q, e->next);
+        e->target = q->tick;
+        e->generation = q->generation;
+        equeue_ready_push(q, e);
+    }
+
+    // merge delayed events into the scheduler
+    for (struct equeue_event *e = equeue_ptr(q, delayed); e;
+            e = equeue_ptr(q, e->next)) {
+        e->generation = q->generation;
+    }
+    equeue_sched_insert_list(q, equeue_ptr(q, delayed), tick);
+
+    // notify background timer once if the next deadline moved up
+    unsigned next;
+    if ((q->background.update && q->background.active) &&
+        equeue_next(q, &next) &&
+        (!pending || equeue_tickdiff(next, prev) < 0)) {
+        q->background.update(q->background.timer,
+                equeue_tick2ms(q->ready ? 0 : equeue_clampdiff(next, tick)));
+    }
+
+    equeue_mutex_unlock(&q->queuelock);
+#endif
+
+    equeue_sema_signal(&q->eventsema);
+}
+
+static void equeue_cancel_handle(equeue_t *q, equeue_id64_t id, bool wide) {
+    if (!id) {
+        return;
+    }
+
+    struct equeue_event *e = equeue_unqueue(q, id, wide);
+    if (e) {
+        equeue_dealloc(q, e + 1);
+    }
+}
+
+void equeue_cancel(equeue_t *q, int id) {
+    equeue_cancel_handle(q, (uint32_t)id, false);
+}
+
+void equeue_cancel_id64(equeue_t *q, equeue_id64_t id) {
+    equeue_cancel_handle(q, id, true);
+}
+
+static int equeue_timeleft_ticks(equeue_t *q, equeue_id64_t id, bool wide) {
+    int ret = -1;
+
+    if (!id) {
+        return -1;
+    }
+
+    // decode event from unique id and check that the local id matches
+    equeue_mutex_lock(&q->queuelock);
+    struct equeue_event *e = equeue_decode(q, id, wide);
+    if (e) {
+        // events without delays are always due
+        ret = (equeue_ptr(q, e->sibling) == e) ? 0 :
+                equeue_clampdiff(e->target, equeue_tick());
+    }
+    equeue_mutex_unlock(&q->queuelock);
+    return ret;
+}
+
+int equeue_timeleft(equeue_t *q, int id) {
+    return equeue_tick2ms(equeue_timeleft_ticks(q, (uint32_t)id, false));
+}
+
+int equeue_timeleft_us(equeue_t *q, int id) {
+    return equeue_tick2us(equeue_timeleft_ticks(q, (uint32_t)id, false));
+}
+
+int equeue_timeleft_id64(equeue_t *q, equeue_id64_t id) {
+    return equeue_tick2ms(equeue_timeleft_ticks(q, id, true));
+}
+
+void equeue_break(equeue_t *q) {
+    equeue_mutex_lock(&q->queuelock);
+    q->break_requested = true;
+    equeue_mutex_unlock(&q->queuelock);
+    equeue_sema_signal(&q->eventsema);
+}
+
+// run a dequeued event, then reenqueue it if it is periodic or deallocate
+// it, reusing the tick from the dispatch loop to avoid reading the clock per
+// event
+static inline void equeue_run(equeue_t *q,
+        struct equeue_event *e, unsigned tick) {
+    // actually dispatch the callbacks
+    void (*cb)(void *) = e->cb;
+    if (cb) {
+        cb(e + 1);
+    }
+
+    if (equeue_period(e) >= 0) {
+        e->target += equeue_period(e);
+        equeue_enqueue(q, e, tick);
+    } else {
+        equeue_incid(q, e);
+        equeue_dealloc(q, e+1);
+    }
+}
+
+// update the background timer when a dispatch loop returns
+static void equeue_background_resume(equeue_t *q, unsigned tick) {
+    if (q->background.update) {
+        equeue_mutex_lock(&q->queuelock);
+        unsigned target;
+        if (q->background.update && equeue_next(q, &target)) {
+            q->background.update(q->background.timer,
+                    equeue_tick2ms(equeue_clampdiff(target, tick)));
+        }
+        q->background.active = true;
+        equeue_mutex_unlock(&q->queuelock);
+    }
+}
+
+void equeue_dispatch(equeue_t *q, int ms) {
+    unsigned tick = equeue_tick();
+    unsigned timeout = tick + equeue_ms2tick(ms);
+    q->background.active = false;
+
+    while (1) {
+        // collect all the available events and next deadline
+        struct equeue_event *es = equeue_dequeue(q, tick);
+        bool dispatched = es;
+
+        // dispatch events
+        while (es) {
+#if defined(EQUEUE_PRIORITIES)
+            // run newly posted events of a higher priority first
+            struct equeue_event *p;
+            while ((p = equeue_preempt(q, equeue_priority(es), tick))) {
+                equeue_run(q, p, tick);
+            }
+#endif
+
+            struct equeue_event *e = es;
+            es = equeue_ptr(q, e->next);
+            equeue_run(q, e, tick);
+        }
+
+        // callbacks may take a while, so the tick only needs to be reread
+        // if events were actually dispatched
+        if (dispatched) {
+            tick = equeue_tick();
+        }
+
+        int deadline = -1;
+
+        // check if we should stop dispatching soon
+        if (ms >= 0) {
+            deadline = equeue_tickdiff(timeout, tick);
+            if (deadline <= 0) {
+                // update background timer if necessary
+                equeue_background_resume(q, tick);
+                q->break_requested = false;
+                return;
+            }
+        }
+
+        // find closest deadline
+        equeue_mutex_lock(&q->queuelock);
+        unsigned target;
+        if (equeue_next(q, &target)) {
+            int diff = equeue_clampdiff(target, tick);
+            if ((unsigned)diff < (unsigned)deadline) {
+                deadline = diff;
+            }
+        }
+        equeue_mutex_unlock(&q->queuelock);
+
+        // wait for events, with nothing to wait for the current tick is
+        // still good for the next iteration
+        bool waited = (deadline != 0);
+        if (waited) {
+            equeue_sema_wait(&q->eventsema, deadline);
+        }
+
+        // check if we were notified to break out of dispatch
+        if (q->break_requested) {
+            equeue_mutex_lock(&q->queuelock);
+            if (q->break_requested) {
+                q->break_requested = false;
+                equeue_mutex_unlock(&q->queuelock);
+                return;
+            }
+            equeue_mutex_unlock(&q->queuelock);
+        }
+
+        // update tick for next iteration
+        if (waited) {
+            tick = equeue_tick();
+        }
+    }
+}
+
+
+#if defined(EQUEUE_WORKERS)
+// multi-threaded dispatch, expired events go in the queue's shared batch
+// where any worker can take them
+struct equeue_workers {
+    equeue_t *q;
+    int ms;
+    unsigned timeout;
+    volatile bool stop;
+    volatile bool expired;
+};
+
+// take the next event from the shared batch, dequeueing a new batch once it
+// runs dry, and wake another worker while events are left over
+static struct equeue_event *equeue_batch_take(equeue_t *q,
+        unsigned tick, bool dequeue) {
+    equeue_mutex_lock(&q->queuelock);
+    struct equeue_event *e = equeue_ptr(q, q->batch);
+    if (e) {
+        q->batch = e->next;
+    }
+    bool more = q->batch;
+    equeue_mutex_unlock(&q->queuelock);
+
+    if (!e && dequeue) {
+        e = equeue_dequeue(q, tick);
+        if (e && e->next) {
+            equeue_mutex_lock(&q->queuelock);
+            equeue_link_t *tail = &q->batch;
+            while (*tail) {
+                tail = &equeue_ptr(q, *tail)->next;
+            }
+            *tail = e->next;
+            equeue_mutex_unlock(&q->queuelock);
+            more = true;
+        }
+    }
+
+    if (more) {
+        equeue_sema_signal(&q->eventsema);
+    }
+
+    return e;
+}
+
+static void equeue_worker(void *p) {
+    struct equeue_workers *w = p;
+    equeue_t *q = w->q;
+    unsigned tick = equeue_tick();
+    bool dispatched = false;
+
+    while (1) {
+        // once stopped, only finish what is left of the shared batch, and
+        // finish the batch before dequeueing again so the timeout and
+        // breaks are still checked under continuous load
+        struct equeue_event *e = equeue_batch_take(q, tick, !w->stop);
+        while (e) {
+#if defined(EQUEUE_PRIORITIES)
+            // run newly posted events of a higher priority first
+            struct equeue_event *p;
+            while ((p = equeue_preempt(q, equeue_priority(e), tick))) {
+                equeue_run(q, p, tick);
+            }
+#endif
+
+            equeue_run(q, e, tick);
+            dispatched = true;
+            e = equeue_batch_take(q, tick, false);
+        }
+
+        if (w->stop) {
+            break;
+        }
+
+        // callbacks may take a while, so the tick only needs to be reread
+        // if events were actually dispatched
+        if (dispatched) {
+            tick = equeue_tick();
+            dispatched = false;
+        }
+
+        int deadline = -1;
+        if (w->ms >= 0) {
+            deadline = equeue_tickdiff(w->timeout, tick);
+            if (deadline <= 0) {
+                w->expired = true;
+                break;
+            }
+        }
+
+        // find closest deadline
+        equeue_mutex_lock(&q->queuelock);
+        unsigned target;
+        if (equeue_next(q, &target)) {
+            int diff = equeue_clampdiff(target, tick);
+            if ((unsigned)diff < (unsigned)deadline) {
+                deadline = diff;
+            }
+        }
+        equeue_mutex_unlock(&q->queuelock);
+
+        bool waited = (deadline != 0);
+        if (waited) {
+            equeue_sema_wait(&q->eventsema, deadline);
+        }
+
+        // a break stops every worker
+        if (q->break_requested) {
+            equeue_mutex_lock(&q->queuelock);
+            if (q->break_requested) {
+                q->break_requested = false;
+                w->stop = true;
+            }
+            equeue_mutex_unlock(&q->queuelock);
+        }
+
+        if (waited) {
+            tick = equeue_tick();
+        }
+    }
+
+    // wake the next worker so every worker notices we're done
+    w->stop = true;
+    equeue_sema_signal(&q->eventsema);
+}
+
+void equeue_dispatch_workers(equeue_t *q, int nthreads, int ms) {
+    struct equeue_workers w = {
+        .q = q,
+        .ms = ms,
+        .timeout = equeue_tick() + equeue_ms2tick(ms),
+        .stop = false,
+        .expired = false,
+    };
+    q->background.active = false;
+
+#if defined(EQUEUE_THREADS)
+    // start the worker threads, making do with fewer if some can't start
+    int count = 0;
+    equeue_thread_t *threads = 0;
+    if (nthreads > 1) {
+        threads = malloc((nthreads-1)*sizeof(equeue_thread_t));
+    }
+
+    while (threads && count < nthreads-1 &&
+            equeue_thread_create(&threads[count], equeue_worker, &w) == 0) {
+        count += 1;
+    }
+#endif
+
+    // the calling thread is a worker too
+    equeue_worker(&w);
+
+#if defined(EQUEUE_THREADS)
+    for (int i = 0; i < count; i++) {
+        equeue_thread_join(&threads[i]);
+    }
+    free(threads);
+#endif
+
+    if (w.expired) {
+        equeue_background_resume(q, equeue_tick());
+        q->break_requested = false;
+    }
+}
+#endif
+
+
+#if defined(EQUEUE_GROUPS)
+// sharded event queue groups, stolen events are marked with an older
+// generation so they look in-flight to equeue_unqueue, the same as events
+// dequeued by their own shard
+#if defined(EQUEUE_THREAD_LOCAL)
+// each thread remembers its local shard for a few groups, replacing the
+// oldest entry when it uses another group
+static EQUEUE_THREAD_LOCAL struct {
+    struct equeue_group_local {
+        equeue_group_t *g;
+        unsigned shard;
+    } locals[EQUEUE_GROUP_LOCALS];
+    unsigned next;
+} equeue_group_thread;
+
+static void equeue_group_setlocal(equeue_group_t *g, unsigned shard) {
+    struct equeue_group_local *l = 0;
+    for (unsigned i = 0; i < EQUEUE_GROUP_LOCALS; i++) {
+        if (equeue_group_thread.locals[i].g == g) {
+            l = &equeue_group_thread.locals[i];
+            break;
+        }
+    }
+
+    if (!l) {
+        l = &equeue_group_thread.locals[equeue_group_thread.next];
+        equeue_group_thread.next =
+                (equeue_group_thread.next + 1) % EQUEUE_GROUP_LOCALS;
+    }
+
+    l->g = g;
+    l->shard = shard;
+}
+#endif
+
+// hand out shards round-robin
+static unsigned equeue_group_next(equeue_group_t *g) {
+    equeue_mutex_lock(&g->lock);
+    unsigned shard = g->next;
+    g->next = (shard + 1) % g->count;
+    equeue_mutex_unlock(&g->lock);
+    return shard;
+}
+
+static unsigned equeue_group_shard(equeue_group_t *g) {
+#if defined(EQUEUE_THREAD_LOCAL)
+    // a new group may reuse the address of a destroyed one, so keep stale
+    // shards in range
+    for (unsigned i = 0; i < EQUEUE_GROUP_LOCALS; i++) {
+        if (equeue_group_thread.locals[i].g == g) {
+            return equeue_group_thread.locals[i].shard % g->count;
+        }
+    }
+
+    unsigned shard = equeue_group_next(g);
+    equeue_group_setlocal(g, shard);
+    return shard;
+#else
+    // without thread-local storage, spread posts over the shards
+    return equeue_group_next(g);
+#endif
+}
+
+// take the first ready event of another shard, events posted through the
+// intake are spliced into the shard first
+static struct equeue_event *equeue_group_steal(equeue_group_t *g,
+        unsigned shard, unsigned tick, equeue_t **owner) {
+    for (unsigned i = 1; i < g->count; i++) {
+        equeue_t *q = &g->shards[(shard + i) % g->count];
+#if defined(EQUEUE_INTAKE)
+        if (!q->ready && !q->intake) {
+            continue;
+        }
+
+        equeue_mutex_lock(&q->queuelock);
+        equeue_intake_splice(q, tick);
+#else
+        if (!q->ready) {
+            continue;
+        }
+
+        equeue_mutex_lock(&q->queuelock);
+#endif
+        struct equeue_event *e = equeue_ptr(q, q->ready);
+        if (e) {
+            equeue_ready_remove(q, e);
+            e->next = 0;
+            e->generation = q->generation - 1;
+        }
+        equeue_mutex_unlock(&q->queuelock);
+
+        if (e) {
+            *owner = q;
+            return e;
+        }
+    }
+
+    return 0;
+}
+
+// wake an idle dispatcher to steal a newly posted ready event if the shard's
+// own dispatcher is busy, the idle flags are only hints, a missed wakeup is
+// still caught by the dispatchers' poll
+static void equeue_group_wake(equeue_group_t *g, unsigned shard) {
+    if (g->idle[shard]) {
+        return;
+    }
+
+    for (unsigned i = 1; i < g->count; i++) {
+        unsigned j = (shard + i) % g->count;
+        if (g->idle[j]) {
+            g->idle[j] = false;
+            equeue_sema_signal(&g->shards[j].eventsema);
+            return;
+        }
+    }
+}
+
+// group ids put the shard in the bottom bits of the shard's handle
+static inline equeue_id64_t equeue_group_id(equeue_group_t *g,
+        unsigned shard, equeue_id64_t id) {
+    return id ? (id << g->bits) | shard : 0;
+}
+
+static inline equeue_t *equeue_group_decode(equeue_group_t *g,
+        equeue_id64_t *id) {
+    unsigned shard = *id & (((equeue_id64_t)1 << g->bits) - 1);
+    *id >>= g->bits;
+    return shard < g->count ? &g->shards[shard] : 0;
+}
+
+int equeue_group_create(equeue_group_t *g, unsigned count, size_t size) {
+    if (!count) {
+        return -1;
+    }
+
+    g->shards = malloc(count*sizeof(equeue_t));
+    g->idle = malloc(count*sizeof(bool));
+    if (!g->shards || !g->idle) {
+        free(g->shards);
+        free((bool *)g->idle);
+        return -1;
+    }
+
+    int err = equeue_mutex_create(&g->lock);
+    if (err < 0) {
+        free(g->shards);
+        free((bool *)g->idle);
+        return err;
+    }
 
-    // reverse and flatten each slot to match insertion order
-    struct equeue_event **tail = &head;
-    struct equeue_event *ess = head;
-    while (ess) {
-        struct equeue_event *es = ess;
-        ess = es->next;
+    for (unsigned i = 0; i < count; i++) {
+        err = equeue_create(&g->shards[i], size);
+        if (err) {
+            while (i > 0) {
+                i -= 1;
+                equeue_destroy(&g->shards[i]);
+            }
 
-        struct equeue_event *prev = 0;
-        for (struct equeue_event *e = es; e; e = e->sibling) {
-            e->next = prev;
-            prev = e;
+            equeue_mutex_destroy(&g->lock);
+            free(g->shards);
+            free((bool *)g->idle);
+            return err;
         }
+    }
 
-        *tail = prev;
-        tail = &es->next;
+    g->count = count;
+    g->bits = 0;
+    while ((1u << g->bits) < count) {
+        g->bits += 1;
+    }
+    g->next = 0;
+    for (unsigned i = 0; i < count; i++) {
+        g->idle[i] = false;
     }
 
-    return head;
+    return 0;
 }
 
-int equeue_post(equeue_t *q, void (*cb)(void*), void *p) {
-    struct equeue_event *e = (struct equeue_event*)p - 1;
-    unsigned tick = equeue_tick();
-    e->cb = cb;
-    e->target = tick + e->target;
+void equeue_group_destroy(equeue_group_t *g) {
+    for (unsigned i = 0; i < g->count; i++) {
+        equeue_destroy(&g->shards[i]);
+    }
 
-    int id = equeue_enqueue(q, e, tick);
-    equeue_sema_signal(&q->eventsema);
-    return id;
+    equeue_mutex_destroy(&g->lock);
+    free(g->shards);
+    free((bool *)g->idle);
 }
 
-void equeue_cancel(equeue_t *q, int id) {
-    if (!id) {
-        return;
-    }
+equeue_t *equeue_group_local(equeue_group_t *g) {
+    return &g->shards[equeue_group_shard(g)];
+}
 
-    struct equeue_event *e = equeue_unqueue(q, id);
-    if (e) {
-        equeue_dealloc(q, e + 1);
+equeue_id64_t equeue_group_call(equeue_group_t *g,
+        void (*cb)(void *), void *data) {
+    unsigned shard = equeue_group_shard(g);
+    equeue_id64_t id = equeue_call_id64(&g->shards[shard], cb, data);
+    if (id) {
+        equeue_group_wake(g, shard);
     }
-}
 
-int equeue_timeleft(equeue_t *q, int id) {
-    int ret = -1;
+    return equeue_group_id(g, shard, id);
+}
 
-    if (!id) {
-        return -1;
-    }
+equeue_id64_t equeue_group_call_in(equeue_group_t *g, int ms,
+        void (*cb)(void *), void *data) {
+    unsigned shard = equeue_group_shard(g);
+    return equeue_group_id(g, shard,
+            equeue_call_in_id64(&g->shards[shard], ms, cb, data));
+}
 
-    // decode event from unique id and check that the local id matches
-    struct equeue_event *e = (struct equeue_event *)
-            &q->buffer[id & ((1 << q->npw2)-1)];
+equeue_id64_t equeue_group_call_every(equeue_group_t *g, int ms,
+        void (*cb)(void *), void *data) {
+    unsigned shard = equeue_group_shard(g);
+    return equeue_group_id(g, shard,
+            equeue_call_every_id64(&g->shards[shard], ms, cb, data));
+}
 
-    equeue_mutex_lock(&q->queuelock);
-    if (e->id == id >> q->npw2) {
-        ret = equeue_clampdiff(e->target, equeue_tick());
+void equeue_group_cancel(equeue_group_t *g, equeue_id64_t id) {
+    equeue_t *q = equeue_group_decode(g, &id);
+    if (q) {
+        equeue_cancel_id64(q, id);
     }
-    equeue_mutex_unlock(&q->queuelock);
-    return ret;
 }
 
-void equeue_break(equeue_t *q) {
-    equeue_mutex_lock(&q->queuelock);
-    q->break_requested = true;
-    equeue_mutex_unlock(&q->queuelock);
-    equeue_sema_signal(&q->eventsema);
+int equeue_group_timeleft(equeue_group_t *g, equeue_id64_t id) {
+    equeue_t *q = equeue_group_decode(g, &id);
+    return q ? equeue_timeleft_id64(q, id) : -1;
 }
 
-void equeue_dispatch(equeue_t *q, int ms) {
+void equeue_group_dispatch(equeue_group_t *g, unsigned shard, int ms) {
+    equeue_t *q = &g->shards[shard];
+#if defined(EQUEUE_THREAD_LOCAL)
+    equeue_group_setlocal(g, shard);
+#endif
+
     unsigned tick = equeue_tick();
-    unsigned timeout = tick + ms;
+    unsigned timeout = tick + equeue_ms2tick(ms);
     q->background.active = false;
 
     while (1) {
         // collect all the available events and next deadline
         struct equeue_event *es = equeue_dequeue(q, tick);
+        bool dispatched = es;
 
         // dispatch events
         while (es) {
+#if defined(EQUEUE_PRIORITIES)
+            // run newly posted events of a higher priority first
+            struct equeue_event *p;
+            while ((p = equeue_preempt(q, equeue_priority(es), tick))) {
+                equeue_run(q, p, tick);
+            }
+#endif
+
             struct equeue_event *e = es;
-            es = e->next;
+            es = equeue_ptr(q, e->next);
+            equeue_run(q, e, tick);
+        }
 
-            // actually dispatch the callbacks
-            void (*cb)(void *) = e->cb;
-            if (cb) {
-                cb(e + 1);
+        // with nothing of our own to dispatch, help another shard before
+        // checking our own shard again
+        bool stolen = false;
+        if (!dispatched) {
+            equeue_t *owner;
+            struct equeue_event *e = equeue_group_steal(g, shard,
+                    tick, &owner);
+            if (e) {
+                equeue_run(owner, e, tick);
+                dispatched = true;
+                stolen = true;
             }
+        }
 
-            // reenqueue periodic events or deallocate
-            if (e->period >= 0) {
-                e->target += e->period;
-                equeue_enqueue(q, e, equeue_tick());
-            } else {
-                equeue_incid(q, e);
-                equeue_dealloc(q, e+1);
-            }
+        if (dispatched) {
+            tick = equeue_tick();
         }
 
         int deadline = -1;
-        tick = equeue_tick();
 
         // check if we should stop dispatching soon
         if (ms >= 0) {
             deadline = equeue_tickdiff(timeout, tick);
             if (deadline <= 0) {
-                // update background timer if necessary
-                if (q->background.update) {
-                    equeue_mutex_lock(&q->queuelock);
-                    if (q->background.update && q->queue) {
-                        q->background.update(q->background.timer,
-                                equeue_clampdiff(q->queue->target, tick));
-                    }
-                    q->background.active = true;
-                    equeue_mutex_unlock(&q->queuelock);
-                }
+                equeue_background_resume(q, tick);
                 q->break_requested = false;
                 return;
             }
         }
 
-        // find closest deadline
+        // find closest deadline, waking up regularly to look for events
+        // to steal, or right away if there may be more to steal
         equeue_mutex_lock(&q->queuelock);
-        if (q->queue) {
-            int diff = equeue_clampdiff(q->queue->target, tick);
+        unsigned target;
+        if (equeue_next(q, &target)) {
+            int diff = equeue_clampdiff(target, tick);
             if ((unsigned)diff < (unsigned)deadline) {
                 deadline = diff;
             }
         }
         equeue_mutex_unlock(&q->queuelock);
 
-        // wait for events
-        equeue_sema_wait(&q->eventsema, deadline);
+        int poll = stolen ? 0 : equeue_ms2tick(EQUEUE_GROUP_POLL);
+        if (g->count > 1 && (unsigned)poll < (unsigned)deadline) {
+            deadline = poll;
+        }
+
+        bool waited = (deadline != 0);
+        if (waited) {
+            g->idle[shard] = true;
+            equeue_sema_wait(&q->eventsema, deadline);
+            g->idle[shard] = false;
+        }
 
         // check if we were notified to break out of dispatch
         if (q->break_requested) {
@@ -461,26 +3158,297 @@ void equeue_dispatch(equeue_t *q, int ms) {
             equeue_mutex_unlock(&q->queuelock);
         }
 
-        // update tick for next iteration
-        tick = equeue_tick();
+        if (waited) {
+            tick = equeue_tick();
+        }
+    }
+}
+
+void equeue_group_break(equeue_group_t *g) {
+    for (unsigned i = 0; i < g->count; i++) {
+        equeue_break(&g->shards[i]);
+    }
+}
+#endif
+
+
+#if defined(EQUEUE_STRANDS)
+// serial strands, calls wait in the strand's list until they reach its
+// head, and only the head is posted to the queue
+struct estrand {
+    equeue_strand_t *strand;
+    struct estrand *next;
+    void (*cb)(void*);
+    void *data;
+};
+
+static void estrand_dispatch(void *p) {
+    struct estrand *e = (struct estrand*)p;
+    equeue_strand_t *s = e->strand;
+    e->cb(e->data);
+
+    // the next call is already allocated, so posting it can't fail
+    equeue_mutex_lock(&s->lock);
+    struct estrand *next = e->next;
+    s->head = next;
+    if (!next) {
+        s->tail = 0;
+    }
+    equeue_mutex_unlock(&s->lock);
+
+    if (next) {
+        equeue_post(s->queue, estrand_dispatch, next);
+    }
+}
+
+int equeue_strand_create(equeue_strand_t *s, equeue_t *q) {
+    s->queue = q;
+    s->head = 0;
+    s->tail = 0;
+    return equeue_mutex_create(&s->lock);
+}
+
+void equeue_strand_destroy(equeue_strand_t *s) {
+    // the head is owned by the queue once posted
+    struct estrand *e = s->head ? ((struct estrand*)s->head)->next : 0;
+    while (e) {
+        struct estrand *next = e->next;
+        equeue_dealloc(s->queue, e);
+        e = next;
+    }
+
+    equeue_mutex_destroy(&s->lock);
+}
+
+int equeue_strand_call(equeue_strand_t *s, void (*cb)(void*), void *data) {
+    struct estrand *e = equeue_alloc_ext(s->queue,
+            sizeof(struct estrand), false);
+    if (!e) {
+        return -1;
+    }
+
+    e->strand = s;
+    e->next = 0;
+    e->cb = cb;
+    e->data = data;
+
+    equeue_mutex_lock(&s->lock);
+    bool idle = !s->head;
+    if (idle) {
+        s->head = e;
+    } else {
+        ((struct estrand*)s->tail)->next = e;
+    }
+    s->tail = e;
+    equeue_mutex_unlock(&s->lock);
+
+    if (idle) {
+        equeue_post(s->queue, estrand_dispatch, e);
+    }
+
+    return 0;
+}
+#endif
+
+
+#if defined(EQUEUE_OFFLOAD)
+// offload pools, offloaded work waits in the pool's list until a worker
+// takes it, and the work's event is then posted to run the done function
+struct eoffload {
+    struct eoffload *next;
+    void (*work)(void*);
+    void (*done)(void*);
+    void *data;
+};
+
+static void eoffload_dispatch(void *p) {
+    struct eoffload *e = (struct eoffload*)p;
+    e->done(e->data);
+}
+
+// without worker threads, work runs in the dispatch loop
+static void eoffload_dispatch_work(void *p) {
+    struct eoffload *e = (struct eoffload*)p;
+    e->work(e->data);
+    if (e->done) {
+        e->done(e->data);
+    }
+}
+
+#if defined(EQUEUE_THREADS)
+static void equeue_offload_worker(void *p) {
+    equeue_offload_t *o = p;
+
+    while (1) {
+        equeue_mutex_lock(&o->lock);
+        struct eoffload *e = o->head;
+        if (e) {
+            o->head = e->next;
+            if (!e->next) {
+                o->tail = 0;
+            }
+        }
+        bool more = o->head;
+        bool stop = o->stop;
+        equeue_mutex_unlock(&o->lock);
+
+        // wake another worker while work is left over
+        if (more) {
+            equeue_sema_signal(&o->sema);
+        }
+
+        // once stopped, only finish what is left of the work
+        if (!e) {
+            if (stop) {
+                break;
+            }
+
+            equeue_sema_wait(&o->sema, -1);
+            continue;
+        }
+
+        e->work(e->data);
+
+        // the event was allocated with the work, so posting can't fail
+        if (e->done) {
+            equeue_post(o->queue, eoffload_dispatch, e);
+        } else {
+            equeue_dealloc(o->queue, e);
+        }
+    }
+
+    // wake the next worker so every worker notices we're done
+    equeue_sema_signal(&o->sema);
+}
+#endif
+
+int equeue_offload_create(equeue_offload_t *o, equeue_t *q, int nthreads) {
+    o->queue = q;
+    o->head = 0;
+    o->tail = 0;
+    o->stop = false;
+    o->count = 0;
+
+    int err = equeue_mutex_create(&o->lock);
+    if (err < 0) {
+        return err;
+    }
+
+    err = equeue_sema_create(&o->sema);
+    if (err < 0) {
+        equeue_mutex_destroy(&o->lock);
+        return err;
+    }
+
+#if defined(EQUEUE_THREADS)
+    // start the worker threads, making do with fewer if some can't start
+    o->threads = 0;
+    if (nthreads > 0) {
+        o->threads = malloc(nthreads*sizeof(equeue_thread_t));
+    }
+
+    while (o->threads && o->count < nthreads &&
+            equeue_thread_create(&o->threads[o->count],
+                equeue_offload_worker, o) == 0) {
+        o->count += 1;
+    }
+#endif
+
+    return 0;
+}
+
+void equeue_offload_destroy(equeue_offload_t *o) {
+    equeue_mutex_lock(&o->lock);
+    o->stop = true;
+    equeue_mutex_unlock(&o->lock);
+    equeue_sema_signal(&o->sema);
+
+#if defined(EQUEUE_THREADS)
+    for (int i = 0; i < o->count; i++) {
+        equeue_thread_join(&o->threads[i]);
+    }
+    free(o->threads);
+#endif
+
+    equeue_sema_destroy(&o->sema);
+    equeue_mutex_destroy(&o->lock);
+}
+
+int equeue_offload(equeue_offload_t *o,
+        void (*work)(void*), void (*done)(void*), void *data) {
+    struct eoffload *e = equeue_alloc_ext(o->queue,
+            sizeof(struct eoffload), false);
+    if (!e) {
+        return -1;
+    }
+
+    e->next = 0;
+    e->work = work;
+    e->done = done;
+    e->data = data;
+
+    if (!o->count) {
+        equeue_post(o->queue, eoffload_dispatch_work, e);
+        return 0;
     }
+
+    equeue_mutex_lock(&o->lock);
+    if (o->tail) {
+        ((struct eoffload*)o->tail)->next = e;
+    } else {
+        o->head = e;
+    }
+    o->tail = e;
+    equeue_mutex_unlock(&o->lock);
+
+    equeue_sema_signal(&o->sema);
+    return 0;
 }
+#endif
 
 
 // event functions
 void equeue_event_delay(void *p, int ms) {
     struct equeue_event *e = (struct equeue_event*)p - 1;
-    e->target = ms;
+    e->target = equeue_ms2tick(ms);
+}
+
+void equeue_event_delay_us(void *p, int us) {
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    e->target = equeue_us2tick(us);
 }
 
 void equeue_event_period(void *p, int ms) {
     struct equeue_event *e = (struct equeue_event*)p - 1;
-    e->period = ms;
+    equeue_setperiod(e, equeue_ms2tick(ms));
+}
+
+void equeue_event_period_us(void *p, int us) {
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    equeue_setperiod(e, equeue_us2tick(us));
 }
 
 void equeue_event_dtor(void *p, void (*dtor)(void *)) {
     struct equeue_event *e = (struct equeue_event*)p - 1;
-    e->dtor = dtor;
+    equeue_setdtor(e, dtor);
+}
+
+void equeue_event_slack(void *p, int ms) {
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    int max = EQUEUE_SLACK_MASK;
+    int ticks = equeue_ms2tick(ms);
+    e->slack = (e->slack & ~EQUEUE_SLACK_MASK) |
+            ((ticks < 0) ? 0 : (ticks > max) ? max : ticks);
+}
+
+void equeue_event_priority(void *p, int priority) {
+#if defined(EQUEUE_PRIORITIES)
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    int max = EQUEUE_PRIORITY_LEVELS-1;
+    e->slack = (e->slack & ~EQUEUE_SLACK_PRIORITY) |
+            (((priority < 0) ? 0 : (priority > max) ? max : priority)
+                << EQUEUE_SLACK_PRIORITY_SHIFT);
+#endif
 }
 
 
@@ -496,7 +3464,8 @@ static void ecallback_dispatch(void *p) {
 }
 
 int equeue_call(equeue_t *q, void (*cb)(void*), void *data) {
-    struct ecallback *e = equeue_alloc(q, sizeof(struct ecallback));
+    struct ecallback *e = equeue_alloc_ext(q,
+            sizeof(struct ecallback), false);
     if (!e) {
         return 0;
     }
@@ -507,12 +3476,41 @@ int equeue_call(equeue_t *q, void (*cb)(void*), void *data) {
 }
 
 int equeue_call_in(equeue_t *q, int ms, void (*cb)(void*), void *data) {
-    struct ecallback *e = equeue_alloc(q, sizeof(struct ecallback));
+    struct ecallback *e = equeue_alloc_ext(q,
+            sizeof(struct ecallback), false);
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay(e, ms);
+    e->cb = cb;
+    e->data = data;
+    return equeue_post(q, ecallback_dispatch, e);
+}
+
+int equeue_call_in_us(equeue_t *q, int us, void (*cb)(void*), void *data) {
+    struct ecallback *e = equeue_alloc_ext(q,
+            sizeof(struct ecallback), false);
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay_us(e, us);
+    e->cb = cb;
+    e->data = data;
+    return equeue_post(q, ecallback_dispatch, e);
+}
+
+int equeue_call_in_slack(equeue_t *q, int ms, int slack,
+        void (*cb)(void*), void *data) {
+    struct ecallback *e = equeue_alloc_ext(q,
+            sizeof(struct ecallback), false);
     if (!e) {
         return 0;
     }
 
     equeue_event_delay(e, ms);
+    equeue_event_slack(e, slack);
     e->cb = cb;
     e->data = data;
     return equeue_post(q, ecallback_dispatch, e);
@@ -531,6 +3529,122 @@ int equeue_call_every(equeue_t *q, int ms, void (*cb)(void*), void *data) {
     return equeue_post(q, ecallback_dispatch, e);
 }
 
+int equeue_call_every_us(equeue_t *q, int us, void (*cb)(void*), void *data) {
+    struct ecallback *e = equeue_alloc(q, sizeof(struct ecallback));
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay_us(e, us);
+    equeue_event_period_us(e, us);
+    e->cb = cb;
+    e->data = data;
+    return equeue_post(q, ecallback_dispatch, e);
+}
+
+equeue_id64_t equeue_call_id64(equeue_t *q, void (*cb)(void*), void *data) {
+    struct ecallback *e = equeue_alloc_ext(q,
+            sizeof(struct ecallback), false);
+    if (!e) {
+        return 0;
+    }
+
+    e->cb = cb;
+    e->data = data;
+    return equeue_post_id64(q, ecallback_dispatch, e);
+}
+
+equeue_id64_t equeue_call_in_id64(equeue_t *q, int ms,
+        void (*cb)(void*), void *data) {
+    struct ecallback *e = equeue_alloc_ext(q,
+            sizeof(struct ecallback), false);
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay(e, ms);
+    e->cb = cb;
+    e->data = data;
+    return equeue_post_id64(q, ecallback_dispatch, e);
+}
+
+equeue_id64_t equeue_call_every_id64(equeue_t *q, int ms,
+        void (*cb)(void*), void *data) {
+    struct ecallback *e = equeue_alloc(q, sizeof(struct ecallback));
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay(e, ms);
+    equeue_event_period(e, ms);
+    e->cb = cb;
+    e->data = data;
+    return equeue_post_id64(q, ecallback_dispatch, e);
+}
+
+
+// lock statistics
+void equeue_lockstats(equeue_t *q, struct equeue_lockstats *stats) {
+    memset(stats, 0, sizeof(*stats));
+#if defined(EQUEUE_MUTEX_STATS)
+    equeue_mutex_stats(&q->queuelock,
+            &stats->queue_contended, &stats->queue_parked);
+    equeue_mutex_stats(&q->memlock,
+            &stats->mem_contended, &stats->mem_parked);
+#endif
+}
+
+
+// thread cache release
+void equeue_cache_flush(equeue_t *q) {
+#if defined(EQUEUE_THREAD_CACHE)
+    equeue_mutex_lock(&q->memlock);
+    struct equeue_cache **p = &q->caches;
+    while (*p && (*p)->owner != &equeue_thread) {
+        p = &(*p)->next;
+    }
+
+    struct equeue_cache *c = *p;
+    if (c) {
+        *p = c->next;
+        for (int i = 0; i < EQUEUE_CACHE_CLASSES; i++) {
+            while (c->classes[i].chunks) {
+                struct equeue_event *e = c->classes[i].chunks;
+                c->classes[i].chunks = e->next;
+                equeue_mem_release(q, e);
+            }
+        }
+        equeue_mem_release(q, (struct equeue_event *)c - 1);
+    }
+
+    if (equeue_thread.q == q) {
+        equeue_thread.q = 0;
+        equeue_thread.cache = 0;
+    }
+    equeue_mutex_unlock(&q->memlock);
+#else
+    (void)q;
+#endif
+}
+
+// thread cache statistics
+void equeue_cachestats(equeue_t *q, struct equeue_cachestats *stats) {
+    memset(stats, 0, sizeof(*stats));
+#if defined(EQUEUE_THREAD_CACHE)
+    equeue_mutex_lock(&q->memlock);
+    for (struct equeue_cache *c = q->caches; c; c = c->next) {
+        stats->caches += 1;
+        stats->hits += c->hits;
+        stats->misses += c->misses;
+        stats->flushes += c->flushes;
+        for (int i = 0; i < EQUEUE_CACHE_CLASSES; i++) {
+            stats->cached += c->classes[i].count;
+        }
+    }
+    equeue_mutex_unlock(&q->memlock);
+#endif
+}
+
 
 // backgrounding
 void equeue_background(equeue_t *q,
@@ -543,9 +3657,14 @@ void equeue_background(equeue_t *q,
     q->background.update = update;
     q->background.timer = timer;
 
-    if (q->background.update && q->queue) {
+#if defined(EQUEUE_INTAKE)
+    equeue_intake_splice(q, equeue_tick());
+#endif
+
+    unsigned target;
+    if (q->background.update && equeue_next(q, &target)) {
         q->background.update(q->background.timer,
-                equeue_clampdiff(q->queue->target, equeue_tick()));
+                equeue_tick2ms(equeue_clampdiff(target, equeue_tick())));
     }
     q->background.active = true;
     equeue_mutex_unlock(&q->queuelock);
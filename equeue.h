@@ -21,59 +21,403 @@ extern "C" {
 // Version info
 // Major (top-nibble), incremented on backwards incompatible changes
 // Minor (bottom-nibble), incremented on feature additions
-#define EQUEUE_VERSION 0x00010001
+#define EQUEUE_VERSION 0x00010002
 #define EQUEUE_VERSION_MAJOR (0xffff & (EQUEUE_VERSION >> 16))
 #define EQUEUE_VERSION_MINOR (0xffff & (EQUEUE_VERSION >>  0))
 
 
+// Scheduler configuration
+//
+// By default, pending events are kept in a sorted linked-list which has a
+// small RAM footprint and constant-time insertion for events without delays.
+// Uncomment to select an alternative scheduler for queues with a large number
+// of pending timers. See DESIGN.md for the tradeoffs of each scheduler.
+//
+// EQUEUE_SCHEDULER_WHEEL - Hierarchical timing wheel, constant-time insertion
+//                          and amortized constant-time expiration
+// EQUEUE_SCHEDULER_HEAP  - Implicit 4-ary heap stored at the end of the
+//                          event buffer, logarithmic insertion and expiration,
+//                          each event reserves an extra heap entry
+//#define EQUEUE_SCHEDULER_WHEEL
+//#define EQUEUE_SCHEDULER_HEAP
+
+#if defined(EQUEUE_SCHEDULER_WHEEL) && defined(EQUEUE_SCHEDULER_HEAP)
+#error "Only one equeue scheduler may be selected"
+#endif
+
+// Uncomment to let events be given one of EQUEUE_PRIORITY_LEVELS priorities
+// with equeue_event_priority. Expired events are dispatched highest priority
+// first, and the dispatch loops check for newly posted ready events of a
+// higher priority between callbacks. The priority is stored in the top bits
+// of the event's slack, limiting slack to 16383 ticks, or 8191 ticks with
+// compact events.
+//#define EQUEUE_PRIORITIES
+#define EQUEUE_PRIORITY_LEVELS 4
+
+// Allocator configuration
+//
+// By default, free chunks are kept in a list sorted by size, which costs a
+// single pointer but grows linearly with the number of different event
+// sizes. Uncomment to keep free chunks in size-class bins with an occupancy
+// bitmap instead, giving constant-time allocation and deallocation at the
+// cost of EQUEUE_BINS pointers per queue.
+//#define EQUEUE_ALLOCATOR_BINS
+
+// Uncomment to merge adjacent free chunks, return free chunks at the end of
+// the slab to the slab, and split off the unused end of larger chunks, so
+// buffers survive bursts of mixed event sizes. Coalescing uses the binned
+// allocator and keeps a bitmap of chunk starts at the end of the buffer, one
+// bit per word, so ids of merged chunks can be rejected. The bitmap is
+// allocated on top of the size passed to equeue_create, but comes out of
+// the buffer passed to equeue_create_inplace.
+//#define EQUEUE_ALLOCATOR_COALESCE
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE) && !defined(EQUEUE_ALLOCATOR_BINS)
+#define EQUEUE_ALLOCATOR_BINS
+#endif
+
+// Growth configuration
+//
+// Uncomment to let queues grow by attaching up to EQUEUE_REGIONS-1 extra
+// memory regions with equeue_extend. Queues created with equeue_create also
+// grow automatically with malloc when they run out of memory. Event ids
+// reserve EQUEUE_REGION_BITS bits for the region, and each extra region is
+// limited to the power-of-two size that covers the original buffer. Not
+// supported with the heap scheduler or chunk coalescing, which keep state at
+// the end of the original buffer.
+//#define EQUEUE_GROWABLE
+
+#if defined(EQUEUE_GROWABLE) && (defined(EQUEUE_SCHEDULER_HEAP) \
+        || defined(EQUEUE_ALLOCATOR_COALESCE))
+#error "EQUEUE_GROWABLE is not supported with the heap scheduler or coalescing"
+#endif
+
+// Id configuration
+//
+// Uncomment to widen each event's local id from 8 to 32 bits. The local id
+// is bumped every time a chunk is reused, so with the 64-bit handles of the
+// equeue_id64 functions a stale handle only aliases a new event after 2^32
+// reuses of the same chunk. Costs an extra word in each event.
+//#define EQUEUE_WIDE_IDS
+
+// Intake configuration
+//
+// Uncomment to have equeue_post push events onto a lock-free intake stack
+// instead of taking the queue's lock. The dispatch loop splices the intake
+// into the scheduler at the start of each iteration. This reduces contention
+// when many threads post to a single queue, but requires the platform's
+// atomic operations and delays canceled events in the intake until they are
+// spliced.
+//#define EQUEUE_INTAKE
+
+// Thread cache configuration
+//
+// Uncomment to give each thread a small cache of freed chunks for each queue
+// it allocates from, so steady-state allocation and deallocation of common
+// event sizes does not take the memlock. Each cache keeps up to
+// EQUEUE_CACHE_LIMIT chunks of EQUEUE_CACHE_CLASSES different sizes and is
+// refilled and flushed half a limit at a time. Caches are carved out of the
+// event buffer the first time a thread uses a queue. Chunks held in one
+// thread's cache are not available to other threads, but a thread returns
+// its own cache to the queue before failing an allocation. A thread that
+// exits should call equeue_cache_flush first, or its cache stays out of
+// reach. Requires thread-local storage and the platform's atomic operations.
+//#define EQUEUE_THREAD_CACHE
+
+// Pool configuration
+//
+// Uncomment to keep free chunks of the size allocated by equeue_call and
+// friends in a lock-free stack instead of the allocator, so these events can
+// be allocated and freed without taking the memlock. Stacked chunks are
+// returned to the allocator if an allocation of another size runs out of
+// memory. Requires the platform's atomic operations.
+//#define EQUEUE_POOL
+
+#if defined(EQUEUE_THREAD_CACHE) && !defined(EQUEUE_THREAD_LOCAL)
+#error "EQUEUE_THREAD_CACHE requires platform thread-local storage"
+#endif
+
+// Parallel dispatch configuration
+//
+// Uncomment to provide equeue_dispatch_workers, which dispatches a single
+// queue on several threads at once. Each queue gets a shared batch of
+// expired events for the workers to take from.
+//#define EQUEUE_WORKERS
+
+// Group configuration
+//
+// Uncomment to provide equeue groups, which shard events over one queue per
+// core and steal ready events between shards.
+//#define EQUEUE_GROUPS
+
+// How often, in milliseconds, an idle dispatcher of an equeue group checks
+// the other shards for ready events to steal. Calls through equeue_group_call
+// wake an idle dispatcher when their own shard's dispatcher is busy, but
+// events posted directly to a busy shard may wait this long to be stolen.
+#ifndef EQUEUE_GROUP_POLL
+#define EQUEUE_GROUP_POLL 100
+#endif
+
+// How many groups each thread remembers its local shard for, a thread that
+// alternates between more groups is assigned a new local shard as it
+// switches between them.
+#ifndef EQUEUE_GROUP_LOCALS
+#define EQUEUE_GROUP_LOCALS 4
+#endif
+
+// Strand configuration
+//
+// Uncomment to provide serial strands, which run their calls one at a time
+// and in order on a queue dispatched by several threads.
+//#define EQUEUE_STRANDS
+
+// Offload configuration
+//
+// Uncomment to provide offload pools, which run blocking work on their own
+// threads and post a done function back to the queue.
+//#define EQUEUE_OFFLOAD
+
+// Layout configuration
+//
+// Uncomment to shrink the event header by storing links as 32-bit offsets
+// into the event buffer and moving the rarely used period and destructor
+// into an extension at the end of the chunk. Events from equeue_call and
+// equeue_call_in skip the extension, events from equeue_alloc and periodic
+// events still carry it. Limits the event buffer to 4GiB and slack to 32767
+// ticks. Only supported with the default scheduler and allocator.
+//#define EQUEUE_COMPACT_EVENTS
+
+#if defined(EQUEUE_COMPACT_EVENTS) && (defined(EQUEUE_SCHEDULER_WHEEL) \
+        || defined(EQUEUE_SCHEDULER_HEAP) || defined(EQUEUE_ALLOCATOR_BINS) \
+        || defined(EQUEUE_GROWABLE) || defined(EQUEUE_INTAKE) \
+        || defined(EQUEUE_THREAD_CACHE) || defined(EQUEUE_POOL))
+#error "EQUEUE_COMPACT_EVENTS only supports the default scheduler and allocator"
+#endif
+
+// Uncomment to align events to cache lines and pad the queue structure so
+// state written by posting threads, the allocator and the dispatch thread
+// lives on separate cache lines. Each event is rounded up to a multiple of
+// EQUEUE_CACHE_LINE bytes, which costs memory for small events. Buffers
+// passed to equeue_create_inplace should be aligned to EQUEUE_CACHE_LINE.
+//#define EQUEUE_CACHE_ALIGNED
+
+
 // The minimum size of an event
 // This size is guaranteed to fit events created by event_call
-#define EQUEUE_EVENT_SIZE (sizeof(struct equeue_event) + 2*sizeof(void*))
+#if defined(EQUEUE_COMPACT_EVENTS)
+#define EQUEUE_EVENT_CHUNK (sizeof(struct equeue_event) + 2*sizeof(void*) + \
+        sizeof(struct equeue_event_ext))
+#else
+#define EQUEUE_EVENT_CHUNK (sizeof(struct equeue_event) + 2*sizeof(void*))
+#endif
+
+#if defined(EQUEUE_CACHE_ALIGNED)
+#define EQUEUE_EVENT_ALIGNED ((EQUEUE_EVENT_CHUNK + EQUEUE_CACHE_LINE-1) \
+        & ~(EQUEUE_CACHE_LINE-1))
+#else
+#define EQUEUE_EVENT_ALIGNED EQUEUE_EVENT_CHUNK
+#endif
+
+#if defined(EQUEUE_SCHEDULER_HEAP)
+#define EQUEUE_EVENT_SIZE (EQUEUE_EVENT_ALIGNED + \
+        sizeof(struct equeue_heap_entry))
+#else
+#define EQUEUE_EVENT_SIZE EQUEUE_EVENT_ALIGNED
+#endif
+
+// Internal event links, with compact events links are offsets into the
+// event buffer and refs are offsets of the link that points to the event
+struct equeue_event;
+#if defined(EQUEUE_COMPACT_EVENTS)
+typedef uint32_t equeue_link_t;
+typedef uint32_t equeue_ref_t;
+
+// Extension at the end of compact events that need a period or destructor
+struct equeue_event_ext {
+    int period;
+    void (*dtor)(void *);
+};
+#else
+typedef struct equeue_event *equeue_link_t;
+typedef struct equeue_event **equeue_ref_t;
+#endif
 
 // Internal event structure
 struct equeue_event {
     unsigned size;
+#if defined(EQUEUE_WIDE_IDS)
+    uint32_t id;
+#else
     uint8_t id;
+#endif
     uint8_t generation;
+    uint16_t slack;
 
-    struct equeue_event *next;
-    struct equeue_event *sibling;
-    struct equeue_event **ref;
+    equeue_link_t next;
+    equeue_link_t sibling;
+    equeue_ref_t ref;
 
     unsigned target;
+#if !defined(EQUEUE_COMPACT_EVENTS)
     int period;
     void (*dtor)(void *);
+#endif
 
     void (*cb)(void *);
     // data follows
 };
 
-// Event queue structure
-typedef struct equeue {
-    struct equeue_event *queue;
-    unsigned tick;
-    bool break_requested;
-    uint8_t generation;
+// Hierarchical timing wheel dimensions
+#define EQUEUE_WHEEL_LEVELS 5
+#define EQUEUE_WHEEL_BITS0  8
+#define EQUEUE_WHEEL_BITSN  6
+#define EQUEUE_WHEEL_SLOTS ((1 << EQUEUE_WHEEL_BITS0) + \
+        (EQUEUE_WHEEL_LEVELS-1)*(1 << EQUEUE_WHEEL_BITSN))
+
+// Allocator size classes, sizes below EQUEUE_BINS_EXACT words each get their
+// own class, larger sizes share a class per power of two
+#define EQUEUE_BINS 64
+#define EQUEUE_BINS_EXACT 32
+
+// Growable queue dimensions
+#define EQUEUE_REGION_BITS 3
+#define EQUEUE_REGIONS (1 << EQUEUE_REGION_BITS)
+
+// Thread cache dimensions and structure, each cache holds chunks of a few
+// exact sizes, linked through their next pointers
+#define EQUEUE_CACHE_CLASSES 4
+#define EQUEUE_CACHE_LIMIT 16
+
+struct equeue_cache {
+    struct equeue_cache *next;
+    const void *owner;
+    unsigned hits;
+    unsigned misses;
+    unsigned flushes;
+    struct equeue_cache_class {
+        unsigned size;
+        unsigned count;
+        struct equeue_event *chunks;
+    } classes[EQUEUE_CACHE_CLASSES];
+};
+
+// Implicit heap dimensions and entry, entries keep a copy of the event's
+// target so the heap can be searched without touching the events
+#define EQUEUE_HEAP_ARITY 4
+
+struct equeue_heap_entry {
+    unsigned target;
+    unsigned seq;
+    struct equeue_event *e;
+};
 
+// Padding that keeps the fields on either side on separate cache lines
+#if defined(EQUEUE_CACHE_ALIGNED)
+#define EQUEUE_CACHE_PAD(name) unsigned char name[EQUEUE_CACHE_LINE];
+#else
+#define EQUEUE_CACHE_PAD(name)
+#endif
+
+// Event queue structure, fields are grouped by who writes them
+typedef struct equeue {
+    // read-mostly
     unsigned char *buffer;
     unsigned npw2;
     void *allocated;
-
-    struct equeue_event *chunks;
-    struct equeue_slab {
+    size_t allocsize;
+    int flags;
+    const struct equeue_allocator *allocator;
+    void *allocctx;
+#if defined(EQUEUE_GROWABLE)
+    struct equeue_region {
+        unsigned char *buffer;
         size_t size;
-        unsigned char *data;
-    } slab;
+        void *allocated;
+        size_t allocsize;
+    } regions[EQUEUE_REGIONS];
+    unsigned nregions;
+#endif
+    EQUEUE_CACHE_PAD(pad0)
+
+    // scheduler, protected by the queuelock, which may be held while taking
+    // the memlock but never the other way around
+    equeue_mutex_t queuelock;
+    equeue_link_t queue;
+    equeue_link_t ready;
+    equeue_link_t *tail;
+#if defined(EQUEUE_SCHEDULER_WHEEL)
+    struct equeue_wheel {
+        unsigned tick;
+        unsigned count;
+        unsigned next;
+        uint32_t map[EQUEUE_WHEEL_SLOTS/32];
+        struct equeue_event *slots[EQUEUE_WHEEL_SLOTS];
+        unsigned mins[EQUEUE_WHEEL_SLOTS - (1 << EQUEUE_WHEEL_BITS0)];
+    } wheel;
+#elif defined(EQUEUE_SCHEDULER_HEAP)
+    struct equeue_heap {
+        struct equeue_heap_entry *entries;
+        unsigned count;
+        unsigned seq;
+    } heap;
+#endif
+    unsigned tick;
+    bool break_requested;
+    uint8_t generation;
+#if defined(EQUEUE_WORKERS)
+    equeue_link_t batch;
+#endif
+#if defined(EQUEUE_PRIORITIES)
+    equeue_link_t *levels[EQUEUE_PRIORITY_LEVELS];
+#endif
 
     struct equeue_background {
         bool active;
         void (*update)(void *timer, int ms);
         void *timer;
     } background;
+    EQUEUE_CACHE_PAD(pad1)
 
-    equeue_sema_t eventsema;
-    equeue_mutex_t queuelock;
+#if defined(EQUEUE_INTAKE)
+    // lock-free intake, pushed by posting threads
+    struct equeue_event *volatile intake;
+    EQUEUE_CACHE_PAD(pad2)
+#endif
+
+    // allocator, protected by the memlock, nests inside the queuelock when
+    // coalesced chunks are checked for an id, so never take the queuelock
+    // while holding it
     equeue_mutex_t memlock;
+#if defined(EQUEUE_ALLOCATOR_BINS)
+    struct equeue_event *bins[EQUEUE_BINS];
+    uint32_t binmap[EQUEUE_BINS/32];
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    uint32_t *starts;
+#endif
+#else
+    equeue_link_t chunks;
+#endif
+    struct equeue_slab {
+        size_t size;
+        unsigned char *data;
+    } slab;
+#if defined(EQUEUE_GROWABLE)
+    unsigned slabregion;
+#endif
+#if defined(EQUEUE_THREAD_CACHE)
+    struct equeue_cache *caches;
+    unsigned serial;
+#endif
+    EQUEUE_CACHE_PAD(pad3)
+
+#if defined(EQUEUE_POOL)
+    // lock-free pool, pushed and popped by any thread
+    void *volatile pool;
+    EQUEUE_CACHE_PAD(pad4)
+#endif
+
+    // signaled by posting threads, waited on by the dispatch thread
+    equeue_sema_t eventsema;
 } equeue_t;
 
 
@@ -89,6 +433,80 @@ int equeue_create(equeue_t *queue, size_t size);
 int equeue_create_inplace(equeue_t *queue, size_t size, void *buffer);
 void equeue_destroy(equeue_t *queue);
 
+// Flags for equeue_create_flags
+//
+// EQUEUE_CREATE_HUGEPAGES - Back the buffer with huge pages where available,
+//                           falling back to regular pages otherwise
+// EQUEUE_CREATE_PREFAULT  - Touch the whole buffer on creation so the first
+//                           burst of events doesn't take page faults
+// EQUEUE_CREATE_LOCKED    - Lock the buffer into memory, failing creation
+//                           if the pages can't be locked
+#define EQUEUE_CREATE_HUGEPAGES 0x1
+#define EQUEUE_CREATE_PREFAULT  0x2
+#define EQUEUE_CREATE_LOCKED    0x4
+
+// Create an event queue with a mapped buffer
+//
+// Like equeue_create, but if any flags are given the buffer is mapped with
+// the platform's page operations instead of malloc and unmapped by
+// equeue_destroy. The buffer may be rounded up to a page, the extra memory
+// is used for events. Regions added by growing the queue are allocated the
+// same way. On platforms without page operations only
+// EQUEUE_CREATE_PREFAULT has an effect.
+int equeue_create_flags(equeue_t *queue, size_t size, int flags);
+
+// Extend an event queue with an additional memory region
+//
+// Attaches the provided buffer to the event queue, allowing more events to
+// be allocated. If buffer is null, the region is allocated the same way as
+// the queue's buffer and freed by equeue_destroy. A buffer larger than the
+// queue's region size is split over several regions.
+//
+// Requires EQUEUE_GROWABLE. Returns 0 on success, or a negative value if
+// the queue has no regions left or the buffer is too small to be useful.
+int equeue_extend(equeue_t *queue, size_t size, void *buffer);
+
+// Pluggable allocator
+//
+// An allocator manages the chunks of memory events live in. Chunks must
+// come out of the memory handed to the allocator with attach, the queue's
+// buffer and any regions added later, so event ids and cancel keep working.
+// Chunks must be aligned like the queue's buffer, and may be reused whole
+// but never split or merged, since stale ids may still point at them. The
+// first sizeof(struct equeue_event) bytes of a chunk hold the event's
+// header, which must be left alone while the chunk is free.
+//
+// attach  - Gives the allocator a region of memory to allocate from
+// alloc   - Returns a chunk of at least size bytes, or null if out of memory
+// dealloc - Returns a chunk of the given size to the allocator
+// size    - Returns the usable size of a chunk, may be null if chunks are
+//           always exactly the requested size
+// flags   - EQUEUE_ALLOCATOR_LOCKFREE if alloc and dealloc are safe to call
+//           from several threads and interrupts at once, otherwise calls
+//           are serialized by the queue's irq-safe memlock
+#define EQUEUE_ALLOCATOR_LOCKFREE 0x1
+
+typedef struct equeue_allocator {
+    void (*attach)(void *ctx, void *buffer, size_t size);
+    void *(*alloc)(void *ctx, size_t size);
+    void (*dealloc)(void *ctx, void *chunk, size_t size);
+    size_t (*size)(void *ctx, void *chunk);
+    int flags;
+} equeue_allocator_t;
+
+// Replace the allocator of an event queue
+//
+// Hands the queue's memory over to the provided allocator, which is then
+// used for every event allocated by the queue, bypassing the built-in
+// allocator, thread caches and pool. The allocator must outlive the queue.
+//
+// Must be called before any events are allocated. Returns 0 on success, or a
+// negative value if events were already allocated or the queue keeps its
+// own data alongside chunks, as with EQUEUE_SCHEDULER_HEAP and
+// EQUEUE_ALLOCATOR_COALESCE.
+int equeue_allocator(equeue_t *queue,
+        const equeue_allocator_t *allocator, void *ctx);
+
 // Dispatch events
 //
 // Executes events until the specified milliseconds have passed. If ms is
@@ -100,6 +518,23 @@ void equeue_destroy(equeue_t *queue);
 // equeue_dispatch does not wait and is irq safe.
 void equeue_dispatch(equeue_t *queue, int ms);
 
+// Dispatch events on several threads
+//
+// Like equeue_dispatch, but dispatches events on nthreads threads, the
+// calling thread and nthreads-1 worker threads started for the duration of
+// the call. Expired events are shared between the threads, so callbacks may
+// run concurrently and out of order, periodic events and cancel behave the
+// same as with equeue_dispatch. A call to equeue_break stops every thread,
+// and equeue_dispatch_workers returns once they have all finished.
+//
+// On platforms without threads, or if threads can't be started, events are
+// dispatched on fewer threads, down to only the calling thread.
+//
+// Requires EQUEUE_WORKERS.
+#if defined(EQUEUE_WORKERS)
+void equeue_dispatch_workers(equeue_t *queue, int nthreads, int ms);
+#endif
+
 // Break out of a running event loop
 //
 // Forces the specified event queue's dispatch loop to terminate. Pending
@@ -111,9 +546,17 @@ void equeue_break(equeue_t *queue);
 // The specified callback will be executed in the context of the event queue's
 // dispatch loop. When the callback is executed depends on the call function.
 //
-// equeue_call       - Immediately post an event to the queue
-// equeue_call_in    - Post an event after a specified time in milliseconds
-// equeue_call_every - Post an event periodically every milliseconds
+// equeue_call          - Immediately post an event to the queue
+// equeue_call_in       - Post an event after a specified time in milliseconds
+// equeue_call_every    - Post an event periodically every milliseconds
+// equeue_call_in_slack - Post an event after a specified time, allowing it
+//                        to be delayed by an additional slack, both in
+//                        milliseconds, see equeue_event_slack
+// equeue_call_in_us    - Post an event after a specified time in microseconds
+// equeue_call_every_us - Post an event periodically every microseconds
+//
+// The _us variants are rounded up to the tick resolution, which is
+// milliseconds unless EQUEUE_TICK_US is defined in equeue_platform.h.
 //
 // All equeue_call functions are irq safe and can act as a mechanism for
 // moving events out of irq contexts.
@@ -124,6 +567,11 @@ void equeue_break(equeue_t *queue);
 int equeue_call(equeue_t *queue, void (*cb)(void *), void *data);
 int equeue_call_in(equeue_t *queue, int ms, void (*cb)(void *), void *data);
 int equeue_call_every(equeue_t *queue, int ms, void (*cb)(void *), void *data);
+int equeue_call_in_slack(equeue_t *queue, int ms, int slack,
+        void (*cb)(void *), void *data);
+int equeue_call_in_us(equeue_t *queue, int us, void (*cb)(void *), void *data);
+int equeue_call_every_us(equeue_t *queue, int us,
+        void (*cb)(void *), void *data);
 
 // Allocate memory for events
 //
@@ -145,14 +593,49 @@ int equeue_call_every(equeue_t *queue, int ms, void (*cb)(void *), void *data);
 void *equeue_alloc(equeue_t *queue, size_t size);
 void equeue_dealloc(equeue_t *queue, void *event);
 
+// Allocate multiple events at once
+//
+// The equeue_alloc_batch function allocates up to count events of the
+// specified size under a single acquisition of the allocator's lock, storing
+// them in the events array. Each event behaves as if allocated by
+// equeue_alloc.
+//
+// The equeue_alloc_batch function is irq safe.
+//
+// Returns the number of events allocated, which may be less than count if
+// there is not enough memory.
+int equeue_alloc_batch(equeue_t *queue, size_t size, void **events, int count);
+
 // Configure an allocated event
 //
 // equeue_event_delay  - Millisecond delay before dispatching an event
 // equeue_event_period - Millisecond period for repeating dispatching an event
 // equeue_event_dtor   - Destructor to run when the event is deallocated
+// equeue_event_slack  - Millisecond slack the event may be delayed by in
+//                       addition to its delay, clamped to the limits below
+// equeue_event_delay_us  - Microsecond delay before dispatching an event
+// equeue_event_period_us - Microsecond period for repeating dispatching
+// equeue_event_priority  - Priority of the event, from 0, the default, up to
+//                          EQUEUE_PRIORITY_LEVELS-1, the most urgent,
+//                          ignored without EQUEUE_PRIORITIES
+//
+// Events with slack are moved to the coarsest tick boundary within their
+// allowed window, so events with nearby deadlines share a target and are
+// dispatched in a single wakeup. Periodic events with slack measure each
+// period from the previous, possibly delayed, target. Events without a delay
+// skip the timers and ignore their slack.
+//
+// Slack is kept in ticks in 16 bits of the event header, and is clamped to
+// 65535 ticks, 16383 ticks with EQUEUE_PRIORITIES, 32767 ticks with
+// EQUEUE_COMPACT_EVENTS, or 8191 ticks with both. With EQUEUE_TICK_US a tick
+// is a microsecond, so the slack is limited to about 65ms or less.
 void equeue_event_delay(void *event, int ms);
 void equeue_event_period(void *event, int ms);
 void equeue_event_dtor(void *event, void (*dtor)(void *));
+void equeue_event_slack(void *event, int ms);
+void equeue_event_delay_us(void *event, int us);
+void equeue_event_period_us(void *event, int us);
+void equeue_event_priority(void *event, int priority);
 
 // Post an event onto the event queue
 //
@@ -168,6 +651,20 @@ void equeue_event_dtor(void *event, void (*dtor)(void *));
 // be passed to equeue_cancel.
 int equeue_post(equeue_t *queue, void (*cb)(void *), void *event);
 
+// Post multiple events onto the event queue
+//
+// The equeue_post_batch function posts count events allocated by equeue_alloc
+// with the same callback under a single acquisition of the queue's lock,
+// and wakes up the dispatch loop at most once. Events without delays are
+// dispatched in the order they appear in the events array.
+//
+// The equeue_post_batch function is irq safe.
+//
+// If ids is not null, the unique id of each event is stored in the ids array
+// and can be passed to equeue_cancel.
+void equeue_post_batch(equeue_t *queue, void (*cb)(void *),
+        void **events, int *ids, int count);
+
 // Cancel an in-flight event
 //
 // Attempts to cancel an event referenced by the unique id returned from
@@ -186,9 +683,77 @@ void equeue_cancel(equeue_t *queue, int id);
 //  If event is delayed, this function can be used to query how much time
 //  is left until the event is due to be dispatched.
 //
+//  The equeue_timeleft function returns milliseconds and the
+//  equeue_timeleft_us function returns microseconds.
+//
 //  This function is irq safe.
 //
 int equeue_timeleft(equeue_t *q, int id);
+int equeue_timeleft_us(equeue_t *q, int id);
+
+// 64-bit event handles
+//
+// The equeue_id64 functions work the same as their int counterparts, but
+// return and accept 64-bit handles. Int ids pack the event's local id and
+// buffer offset into 31 bits, so large buffers leave few bits for the local
+// id and buffers beyond 2^31 bytes can't be addressed at all. Handles have
+// room for the full offset and local id, see EQUEUE_WIDE_IDS.
+//
+// A handle of 0 indicates a failure to allocate the event.
+typedef uint64_t equeue_id64_t;
+
+equeue_id64_t equeue_post_id64(equeue_t *queue,
+        void (*cb)(void *), void *event);
+equeue_id64_t equeue_call_id64(equeue_t *queue,
+        void (*cb)(void *), void *data);
+equeue_id64_t equeue_call_in_id64(equeue_t *queue, int ms,
+        void (*cb)(void *), void *data);
+equeue_id64_t equeue_call_every_id64(equeue_t *queue, int ms,
+        void (*cb)(void *), void *data);
+void equeue_cancel_id64(equeue_t *queue, equeue_id64_t id);
+int equeue_timeleft_id64(equeue_t *queue, equeue_id64_t id);
+
+// Query lock contention
+//
+// Reports how many times each of the event queue's locks was already held
+// when a thread tried to take it, and how many of those times the thread had
+// to park. The counts are only collected if the platform's mutex supports
+// it, such as with EQUEUE_POSIX_ADAPTIVE_MUTEX, otherwise they are zero.
+struct equeue_lockstats {
+    unsigned queue_contended;
+    unsigned queue_parked;
+    unsigned mem_contended;
+    unsigned mem_parked;
+};
+
+void equeue_lockstats(equeue_t *queue, struct equeue_lockstats *stats);
+
+// Query thread caches
+//
+// Reports how many threads have a cache for the event queue, how many
+// chunks the caches currently hold, and how many allocations were served by
+// a cache (hits) or had to take the memlock (misses), and how many times a
+// cache was flushed back to the queue. The counts are approximate while
+// other threads are allocating, and are zero without EQUEUE_THREAD_CACHE.
+struct equeue_cachestats {
+    unsigned caches;
+    unsigned cached;
+    unsigned hits;
+    unsigned misses;
+    unsigned flushes;
+};
+
+void equeue_cachestats(equeue_t *queue, struct equeue_cachestats *stats);
+
+// Release the calling thread's cache
+//
+// Returns the chunks held by the calling thread's cache, and the cache
+// itself, to the event queue. Caches otherwise live as long as the queue,
+// so a thread that exits without calling this strands its cache until
+// another thread happens to reuse the same thread-local storage. Threads
+// that allocate from a queue should call this before exiting. Does nothing
+// without EQUEUE_THREAD_CACHE.
+void equeue_cache_flush(equeue_t *queue);
 
 // Background an event queue onto a single-shot timer
 //
@@ -219,6 +784,152 @@ void equeue_background(equeue_t *queue,
 // platform-specific error code.
 int equeue_chain(equeue_t *queue, equeue_t *target);
 
+// Sharded event queue groups
+//
+// An event queue group owns one event queue per shard, usually one per
+// core, so threads on different cores post and dispatch without contending
+// on the same locks. Each thread is assigned a local shard the first time it
+// uses the group, or takes the shard it dispatches, and the group's call
+// functions post to the calling thread's local shard. Threads remember their
+// local shard for up to EQUEUE_GROUP_LOCALS groups at a time. A dispatcher
+// whose own shard has nothing to do steals ready events from the other
+// shards.
+//
+// Group ids are 64-bit handles that also encode the shard, so they can be
+// passed to equeue_group_cancel and equeue_group_timeleft from any thread.
+// Events posted directly to a shard return that shard's ids instead.
+//
+// If the group creation fails, equeue_group_create returns a negative,
+// platform-specific error code.
+//
+// Requires EQUEUE_GROUPS.
+#if defined(EQUEUE_GROUPS)
+typedef struct equeue_group {
+    equeue_t *shards;
+    unsigned count;
+    unsigned bits;
+    equeue_mutex_t lock;
+    unsigned next;
+    volatile bool *idle;
+} equeue_group_t;
+
+int equeue_group_create(equeue_group_t *group, unsigned count, size_t size);
+void equeue_group_destroy(equeue_group_t *group);
+
+// Find the calling thread's local shard
+equeue_t *equeue_group_local(equeue_group_t *group);
+
+equeue_id64_t equeue_group_call(equeue_group_t *group,
+        void (*cb)(void *), void *data);
+equeue_id64_t equeue_group_call_in(equeue_group_t *group, int ms,
+        void (*cb)(void *), void *data);
+equeue_id64_t equeue_group_call_every(equeue_group_t *group, int ms,
+        void (*cb)(void *), void *data);
+void equeue_group_cancel(equeue_group_t *group, equeue_id64_t id);
+int equeue_group_timeleft(equeue_group_t *group, equeue_id64_t id);
+
+// Dispatch a shard of an event queue group
+//
+// Dispatches the shard's events like equeue_dispatch, stealing ready events
+// from the other shards whenever the shard has nothing to dispatch. Each
+// shard should be dispatched by its own thread, which takes the shard as its
+// local shard. The equeue_group_break function breaks out of every shard's
+// dispatch loop.
+void equeue_group_dispatch(equeue_group_t *group, unsigned shard, int ms);
+void equeue_group_break(equeue_group_t *group);
+#endif
+
+// Serial strands
+//
+// A strand runs the calls made on it one at a time and in the order they
+// were made, while calls on different strands may run in parallel when the
+// queue is dispatched by several threads, with equeue_dispatch_workers or
+// as a shard of an event queue group. Only the strand's oldest call is
+// posted to the queue, the rest wait in the strand until the calls before
+// them have finished. Calls that are waiting in a strand can't be canceled.
+//
+// The strand must outlive its calls. Destroying a strand deallocates any
+// calls still waiting in it, but the strand must not be destroyed while its
+// posted call may still run.
+//
+// If the strand creation fails, equeue_strand_create returns a negative,
+// platform-specific error code.
+//
+// Requires EQUEUE_STRANDS.
+#if defined(EQUEUE_STRANDS)
+typedef struct equeue_strand {
+    equeue_t *queue;
+    void *head;
+    void *tail;
+    equeue_mutex_t lock;
+} equeue_strand_t;
+
+int equeue_strand_create(equeue_strand_t *strand, equeue_t *queue);
+void equeue_strand_destroy(equeue_strand_t *strand);
+
+// Call a function on a strand
+//
+// The specified callback will be executed in the context of the queue's
+// dispatch loop once every call made on the strand before it has finished.
+// Memory for the call is allocated from the queue when the call is made, so
+// running it never fails.
+//
+// The equeue_strand_call function is irq safe. Returns 0 on success, or a
+// negative value if there is not enough memory to allocate the call.
+int equeue_strand_call(equeue_strand_t *strand,
+        void (*cb)(void *), void *data);
+#endif
+
+// Offload blocking work
+//
+// An offload pool runs work functions on a fixed number of worker threads,
+// so long or blocking work doesn't hold up the queue's dispatch loop. Once
+// the work function returns, its done function is posted to the queue and
+// runs in the context of the queue's dispatch loop. Work functions may run
+// concurrently and finish out of order.
+//
+// On platforms without threads, or if no threads can be started, the pool
+// runs each work function in the queue's dispatch loop just before its done
+// function.
+//
+// Destroying the pool waits for every offloaded work function to finish.
+// Done functions that were already posted stay in the queue.
+//
+// If the pool creation fails, equeue_offload_create returns a negative,
+// platform-specific error code.
+//
+// Requires EQUEUE_OFFLOAD.
+#if defined(EQUEUE_OFFLOAD)
+typedef struct equeue_offload {
+    equeue_t *queue;
+    void *head;
+    void *tail;
+    equeue_mutex_t lock;
+    equeue_sema_t sema;
+    volatile bool stop;
+    int count;
+#if defined(EQUEUE_THREADS)
+    equeue_thread_t *threads;
+#endif
+} equeue_offload_t;
+
+int equeue_offload_create(equeue_offload_t *pool,
+        equeue_t *queue, int nthreads);
+void equeue_offload_destroy(equeue_offload_t *pool);
+
+// Offload work to a pool
+//
+// Runs the work function on one of the pool's threads, then posts the done
+// function to the pool's queue, both called with the provided data. The done
+// function may be null. The event for the done function is allocated from
+// the queue when the work is offloaded, so posting it never fails.
+//
+// Returns 0 on success, or a negative value if there is not enough memory
+// to allocate the done function's event.
+int equeue_offload(equeue_offload_t *pool,
+        void (*work)(void *), void (*done)(void *), void *data);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -14,7 +14,8 @@
 
 // Ticker operations
 unsigned equeue_tick(void) {
-    return xTaskGetTickCountFromISR() * portTICK_PERIOD_MS;
+    return xTaskGetTickCountFromISR() *
+            (portTICK_PERIOD_MS * EQUEUE_TICKS_PER_MS);
 }
 
 
@@ -45,14 +46,37 @@ void equeue_sema_signal(equeue_sema_t *s) {
     xSemaphoreGiveFromISR(s->handle, NULL);
 }
 
-bool equeue_sema_wait(equeue_sema_t *s, int ms) {
-    if (ms < 0) {
-        ms = portMAX_DELAY;
+bool equeue_sema_wait(equeue_sema_t *s, int ticks) {
+    TickType_t timeout;
+    if (ticks < 0) {
+        timeout = portMAX_DELAY;
     } else {
-        ms = ms / portTICK_PERIOD_MS;
+        // round up to whole FreeRTOS ticks
+        unsigned period = portTICK_PERIOD_MS * EQUEUE_TICKS_PER_MS;
+        timeout = ticks/period + (ticks % period != 0);
     }
 
-    return xSemaphoreTake(s->handle, ms);
+    return xSemaphoreTake(s->handle, timeout);
+}
+
+
+// Atomic operations
+bool equeue_atomic_cas(void *volatile *ptr, void *expected, void *desired) {
+    UBaseType_t state = taskENTER_CRITICAL_FROM_ISR();
+    bool swapped = (*ptr == expected);
+    if (swapped) {
+        *ptr = desired;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(state);
+    return swapped;
+}
+
+void *equeue_atomic_swap(void *volatile *ptr, void *desired) {
+    UBaseType_t state = taskENTER_CRITICAL_FROM_ISR();
+    void *prev = *ptr;
+    *ptr = desired;
+    taskEXIT_CRITICAL_FROM_ISR(state);
+    return prev;
 }
 
 
@@ -53,9 +53,10 @@ unsigned equeue_tick() {
         // should not be called from critical sections, for
         // performance reasons, but I don't have a good
         // current alternative!
-        return mbed::internal::os_timer->get_time() / 1000;
+        return mbed::internal::os_timer->get_time()
+                / (1000 / EQUEUE_TICKS_PER_MS);
     } else {
-        return rtos::Kernel::get_ms_count();
+        return rtos::Kernel::get_ms_count() * EQUEUE_TICKS_PER_MS;
     }
 #else
     // And this is the legacy behaviour - if running in
@@ -63,7 +64,7 @@ unsigned equeue_tick() {
     // documentation saying no. (Most recent CMSIS-RTOS
     // permits `ososKernelGetTickCount` from IRQ, and our
     // `rtos::Kernel` wrapper copes too).
-    return rtos::Kernel::get_ms_count();
+    return rtos::Kernel::get_ms_count() * EQUEUE_TICKS_PER_MS;
 #endif
 }
 
@@ -120,7 +121,7 @@ unsigned equeue_tick() {
         ms = reinterpret_cast<ALIAS_TIMER*>(equeue_timer)->read_ms();
     } while (minutes != equeue_minutes);
 
-    return minutes + ms;
+    return (minutes + ms) * EQUEUE_TICKS_PER_MS;
 }
 
 #endif
@@ -159,9 +160,13 @@ void equeue_sema_signal(equeue_sema_t *s) {
     osEventFlagsSet(s->id, 1);
 }
 
-bool equeue_sema_wait(equeue_sema_t *s, int ms) {
-    if (ms < 0) {
+bool equeue_sema_wait(equeue_sema_t *s, int ticks) {
+    uint32_t ms;
+    if (ticks < 0) {
         ms = osWaitForever;
+    } else {
+        // round up to whole milliseconds
+        ms = ticks/EQUEUE_TICKS_PER_MS + (ticks % EQUEUE_TICKS_PER_MS != 0);
     }
 
     return (osEventFlagsWait(s->id, 1, osFlagsWaitAny, ms) == 1);
@@ -186,13 +191,14 @@ static void equeue_sema_timeout(equeue_sema_t *s) {
     *s = -1;
 }
 
-bool equeue_sema_wait(equeue_sema_t *s, int ms) {
+bool equeue_sema_wait(equeue_sema_t *s, int ticks) {
     int signal = 0;
     ALIAS_TIMEOUT timeout;
-    if (ms == 0) {
+    if (ticks == 0) {
         return false;
-    } else if (ms > 0) {
-        timeout.attach_us(callback(equeue_sema_timeout, s), (us_timestamp_t)ms*1000);
+    } else if (ticks > 0) {
+        timeout.attach_us(callback(equeue_sema_timeout, s),
+                (us_timestamp_t)ticks*(1000/EQUEUE_TICKS_PER_MS));
     }
 
     core_util_critical_section_enter();
@@ -211,4 +217,18 @@ bool equeue_sema_wait(equeue_sema_t *s, int ms) {
 
 #endif
 
+
+// Atomic operations
+bool equeue_atomic_cas(void *volatile *ptr, void *expected, void *desired) {
+    return core_util_atomic_cas_ptr(ptr, &expected, desired);
+}
+
+void *equeue_atomic_swap(void *volatile *ptr, void *desired) {
+    core_util_critical_section_enter();
+    void *prev = *ptr;
+    *ptr = desired;
+    core_util_critical_section_exit();
+    return prev;
+}
+
 #endif
@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Currently supported platforms
 //
@@ -38,6 +39,13 @@ extern "C" {
 #endif
 #endif
 
+// Use a futex-based semaphore on Linux, define EQUEUE_POSIX_NO_FUTEX to
+// fall back to a pthread condition variable
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(__linux__) \
+ && !defined(EQUEUE_POSIX_NO_FUTEX)
+#define EQUEUE_POSIX_FUTEX
+#endif
+
 // Platform includes
 #if defined(EQUEUE_PLATFORM_POSIX)
 #include <pthread.h>
@@ -52,14 +60,34 @@ extern "C" {
 #endif
 
 
+// Tick resolution
+//
+// Uncomment to run the equeue library on a microsecond tick instead of a
+// millisecond tick. The platform's equeue_tick and equeue_sema_wait then
+// work in microseconds, the millisecond APIs are converted to ticks, and
+// the _us variants of the timing APIs gain their full resolution. Delays
+// are limited to 2^31-1 ticks, about 35 minutes with a microsecond tick.
+//#define EQUEUE_TICK_US
+
+#if defined(EQUEUE_TICK_US)
+#define EQUEUE_TICKS_PER_MS 1000
+#else
+#define EQUEUE_TICKS_PER_MS 1
+#endif
+
+
 // Platform millisecond counter
 //
 // Return a tick that represents the number of milliseconds that have passed
-// since an arbitrary point in time. The granularity does not need to be at
-// the millisecond level, however the accuracy of the equeue library is
-// limited by the accuracy of this tick.
+// since an arbitrary point in time, or microseconds if EQUEUE_TICK_US is
+// defined. The granularity does not need to be at the tick level, however
+// the accuracy of the equeue library is limited by the accuracy of this tick.
 //
 // Must intentionally overflow to 0 after 2^32-1
+//
+// On POSIX platforms the tick is read from CLOCK_MONOTONIC where available.
+// Define EQUEUE_POSIX_COARSE_CLOCK to use the cheaper CLOCK_MONOTONIC_COARSE
+// on Linux, limiting the tick's accuracy to the kernel's timer interrupt.
 unsigned equeue_tick(void);
 
 
@@ -70,7 +98,18 @@ unsigned equeue_tick(void);
 // amount of time, so simply disabling interrupts is acceptable
 //
 // If irq safety is not required, a regular blocking mutex can be used.
-#if defined(EQUEUE_PLATFORM_POSIX)
+//
+// On POSIX platforms, define EQUEUE_POSIX_ADAPTIVE_MUTEX to spin with
+// backoff for up to EQUEUE_POSIX_SPIN_LIMIT attempts before parking on a
+// contended mutex, and to count how often each mutex is contended.
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(EQUEUE_POSIX_ADAPTIVE_MUTEX)
+#define EQUEUE_MUTEX_STATS
+typedef struct equeue_mutex {
+    pthread_mutex_t mutex;
+    unsigned contended;
+    unsigned parked;
+} equeue_mutex_t;
+#elif defined(EQUEUE_PLATFORM_POSIX)
 typedef pthread_mutex_t equeue_mutex_t;
 #elif defined(EQUEUE_PLATFORM_WINDOWS)
 typedef CRITICAL_SECTION equeue_mutex_t;
@@ -93,6 +132,16 @@ void equeue_mutex_destroy(equeue_mutex_t *mutex);
 void equeue_mutex_lock(equeue_mutex_t *mutex);
 void equeue_mutex_unlock(equeue_mutex_t *mutex);
 
+// Platform mutex statistics
+//
+// If the platform defines EQUEUE_MUTEX_STATS, equeue_mutex_stats reports
+// how many times the mutex was already held when locked, and how many of
+// those times the locking thread had to park instead of spinning.
+#if defined(EQUEUE_MUTEX_STATS)
+void equeue_mutex_stats(equeue_mutex_t *mutex,
+        unsigned *contended, unsigned *parked);
+#endif
+
 
 // Platform semaphore type
 //
@@ -105,7 +154,12 @@ void equeue_mutex_unlock(equeue_mutex_t *mutex);
 // A counting semaphore will also work, however may cause the event queue
 // dispatch loop to run unnecessarily. For that matter, equeue_signal_wait
 // may even be implemented as a single return statement.
-#if defined(EQUEUE_PLATFORM_POSIX)
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(EQUEUE_POSIX_FUTEX)
+typedef struct equeue_sema {
+    volatile int signal;
+    volatile int waiters;
+} equeue_sema_t;
+#elif defined(EQUEUE_PLATFORM_POSIX)
 typedef struct equeue_sema {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
@@ -139,12 +193,102 @@ typedef struct equeue_sema {
 // The equeue_sema_wait waits for a semaphore to be signalled or returns
 // immediately if equeue_sema_signal had been called since the last
 // equeue_sema_wait. The equeue_sema_wait returns true if it detected that
-// equeue_sema_signal had been called. If ms is negative, equeue_sema_wait
-// will wait for a signal indefinitely.
+// equeue_sema_signal had been called. The timeout is in ticks, so in
+// microseconds if EQUEUE_TICK_US is defined. If the timeout is negative,
+// equeue_sema_wait will wait for a signal indefinitely.
 int equeue_sema_create(equeue_sema_t *sema);
 void equeue_sema_destroy(equeue_sema_t *sema);
 void equeue_sema_signal(equeue_sema_t *sema);
-bool equeue_sema_wait(equeue_sema_t *sema, int ms);
+bool equeue_sema_wait(equeue_sema_t *sema, int ticks);
+
+
+// Platform atomic operations
+//
+// The equeue_atomic_cas function replaces the pointer at ptr with desired
+// only if it currently equals expected, returning true if the replacement
+// occurred. The equeue_atomic_swap function replaces the pointer at ptr with
+// desired and returns the previous pointer. Both operations must be atomic
+// with respect to other threads and interrupts and act as full barriers.
+//
+// The atomic operations are only needed by the lock-free options of the
+// equeue library and may be left unimplemented otherwise.
+bool equeue_atomic_cas(void *volatile *ptr, void *expected, void *desired);
+void *equeue_atomic_swap(void *volatile *ptr, void *desired);
+
+
+// Platform thread-local storage
+//
+// EQUEUE_THREAD_LOCAL gives each thread its own copy of a static variable.
+// Thread-local storage is only needed by EQUEUE_THREAD_CACHE, and is left
+// undefined on platforms where events may be allocated in interrupts.
+#if !defined(EQUEUE_THREAD_LOCAL)
+#if defined(EQUEUE_PLATFORM_WINDOWS) && defined(_MSC_VER)
+#define EQUEUE_THREAD_LOCAL __declspec(thread)
+#elif (defined(EQUEUE_PLATFORM_POSIX) || defined(EQUEUE_PLATFORM_WINDOWS)) \
+ && defined(__GNUC__)
+#define EQUEUE_THREAD_LOCAL __thread
+#endif
+#endif
+
+
+// Platform cache line size
+//
+// EQUEUE_CACHE_LINE is the size in bytes of the processor's cache lines,
+// used to keep data written by different threads on separate lines when
+// EQUEUE_CACHE_ALIGNED is defined. Must be a power of two.
+#if !defined(EQUEUE_CACHE_LINE)
+#define EQUEUE_CACHE_LINE 64
+#endif
+
+
+// Platform page operations
+//
+// The equeue_pages_map function maps at least size bytes of memory for an
+// event buffer, updating size to the size actually mapped, and returns null
+// on failure. If huge is true, the mapping should be backed by huge pages
+// where the platform can provide them, quietly falling back to regular
+// pages. If lock is true, the pages must be locked into memory, failing the
+// map if they can't be. The equeue_pages_unmap function releases a mapping.
+//
+// The page operations are only needed by equeue_create_flags, platforms
+// that provide them define EQUEUE_PAGES.
+#if defined(EQUEUE_PLATFORM_POSIX) || defined(EQUEUE_PLATFORM_WINDOWS)
+#define EQUEUE_PAGES
+#endif
+
+#if defined(EQUEUE_PAGES)
+void *equeue_pages_map(size_t *size, bool huge, bool lock);
+void equeue_pages_unmap(void *buffer, size_t size);
+#endif
+
+
+// Platform thread operations
+//
+// The equeue_thread_create function starts a thread that calls func with
+// data, returning a negative error code on failure. The thread structure
+// must stay valid until equeue_thread_join, which waits for func to return.
+//
+// The thread operations are only needed by EQUEUE_WORKERS and
+// EQUEUE_OFFLOAD, platforms that provide them define EQUEUE_THREADS.
+#if defined(EQUEUE_PLATFORM_POSIX) || defined(EQUEUE_PLATFORM_WINDOWS)
+#define EQUEUE_THREADS
+#endif
+
+#if defined(EQUEUE_THREADS)
+typedef struct equeue_thread {
+#if defined(EQUEUE_PLATFORM_POSIX)
+    pthread_t thread;
+#elif defined(EQUEUE_PLATFORM_WINDOWS)
+    HANDLE thread;
+#endif
+    void (*func)(void *);
+    void *data;
+} equeue_thread_t;
+
+int equeue_thread_create(equeue_thread_t *thread,
+        void (*func)(void *), void *data);
+void equeue_thread_join(equeue_thread_t *thread);
+#endif
 
 
 #ifdef __cplusplus
@@ -4,24 +4,135 @@
  * Copyright (c) 2016 Christopher Haster
  * Distributed under the MIT license
  */
+// futexes need syscall, which is hidden by strict feature macros
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "equeue_platform.h"
 
 #if defined(EQUEUE_PLATFORM_POSIX)
 
 #include <time.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <errno.h>
+#include <sys/mman.h>
+
+#if defined(EQUEUE_POSIX_FUTEX)
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// Prefer the monotonic clock, the wall clock may jump when it is adjusted
+#if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0 && \
+        !defined(__APPLE__)
+#define EQUEUE_POSIX_MONOTONIC
+
+#if defined(EQUEUE_POSIX_COARSE_CLOCK) && defined(CLOCK_MONOTONIC_COARSE)
+#define EQUEUE_POSIX_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define EQUEUE_POSIX_CLOCK CLOCK_MONOTONIC
+#endif
+#endif
 
 
 // Tick operations
 unsigned equeue_tick(void) {
+#if defined(EQUEUE_POSIX_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(EQUEUE_POSIX_CLOCK, &ts);
+#if defined(EQUEUE_TICK_US)
+    return (unsigned)ts.tv_sec*1000000 + (unsigned)(ts.tv_nsec/1000);
+#else
+    return (unsigned)ts.tv_sec*1000 + (unsigned)(ts.tv_nsec/1000000);
+#endif
+#else
     struct timeval tv;
     gettimeofday(&tv, 0);
+#if defined(EQUEUE_TICK_US)
+    return (unsigned)tv.tv_sec*1000000 + (unsigned)tv.tv_usec;
+#else
     return (unsigned)(tv.tv_sec*1000 + tv.tv_usec/1000);
+#endif
+#endif
 }
 
 
 // Mutex operations
+#if defined(EQUEUE_POSIX_ADAPTIVE_MUTEX)
+// Number of attempts to take a held mutex before parking
+#ifndef EQUEUE_POSIX_SPIN_LIMIT
+#define EQUEUE_POSIX_SPIN_LIMIT 64
+#endif
+
+// Longest backoff between attempts, in pause instructions
+#define EQUEUE_POSIX_SPIN_BACKOFF 64
+
+static inline void equeue_cpu_relax(void) {
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ volatile ("pause");
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ volatile ("yield");
+#endif
+}
+
+int equeue_mutex_create(equeue_mutex_t *m) {
+    m->contended = 0;
+    m->parked = 0;
+    return pthread_mutex_init(&m->mutex, 0);
+}
+
+void equeue_mutex_destroy(equeue_mutex_t *m) {
+    pthread_mutex_destroy(&m->mutex);
+}
+
+void equeue_mutex_lock(equeue_mutex_t *m) {
+    if (pthread_mutex_trylock(&m->mutex) == 0) {
+        return;
+    }
+
+    // critical sections are short, so spin with exponential backoff
+    // before giving up and parking
+    bool parked = true;
+    unsigned backoff = 1;
+    for (int i = 0; i < EQUEUE_POSIX_SPIN_LIMIT; i++) {
+        for (unsigned j = 0; j < backoff; j++) {
+            equeue_cpu_relax();
+        }
+
+        if (backoff < EQUEUE_POSIX_SPIN_BACKOFF) {
+            backoff *= 2;
+        }
+
+        if (pthread_mutex_trylock(&m->mutex) == 0) {
+            parked = false;
+            break;
+        }
+    }
+
+    if (parked) {
+        pthread_mutex_lock(&m->mutex);
+    }
+
+    // the counters are protected by the mutex itself
+    m->contended += 1;
+    m->parked += parked;
+}
+
+void equeue_mutex_unlock(equeue_mutex_t *m) {
+    pthread_mutex_unlock(&m->mutex);
+}
+
+void equeue_mutex_stats(equeue_mutex_t *m,
+        unsigned *contended, unsigned *parked) {
+    pthread_mutex_lock(&m->mutex);
+    *contended = m->contended;
+    *parked = m->parked;
+    pthread_mutex_unlock(&m->mutex);
+}
+#else
 int equeue_mutex_create(equeue_mutex_t *m) {
     return pthread_mutex_init(m, 0);
 }
@@ -37,19 +148,85 @@ void equeue_mutex_lock(equeue_mutex_t *m) {
 void equeue_mutex_unlock(equeue_mutex_t *m) {
     pthread_mutex_unlock(m);
 }
+#endif
 
 
 // Semaphore operations
+#if defined(EQUEUE_POSIX_FUTEX)
+// The semaphore is a single signal word that waiters park on with
+// FUTEX_WAIT. Signalling is a single exchange, and only enters the kernel
+// if the semaphore was not already signalled and a waiter is parked.
+int equeue_sema_create(equeue_sema_t *s) {
+    s->signal = 0;
+    s->waiters = 0;
+    return 0;
+}
+
+void equeue_sema_destroy(equeue_sema_t *s) {
+}
+
+void equeue_sema_signal(equeue_sema_t *s) {
+    if (!__atomic_exchange_n(&s->signal, 1, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST)) {
+        // wake all waiters, the first to wake up consumes the signal
+        syscall(SYS_futex, &s->signal, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+    }
+}
+
+bool equeue_sema_wait(equeue_sema_t *s, int ticks) {
+    if (__atomic_exchange_n(&s->signal, 0, __ATOMIC_SEQ_CST)) {
+        return true;
+    }
+
+    if (ticks == 0) {
+        return false;
+    }
+
+    struct timespec ts = {
+        .tv_sec = ticks/(1000*EQUEUE_TICKS_PER_MS),
+        .tv_nsec = (long)(ticks % (1000*EQUEUE_TICKS_PER_MS))
+                * (1000000/EQUEUE_TICKS_PER_MS),
+    };
+
+    // the kernel only parks us if the semaphore is still unsignalled,
+    // and signallers check for waiters after setting the signal
+    __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &s->signal, FUTEX_WAIT_PRIVATE, 0,
+            (ticks < 0) ? 0 : &ts, 0, 0);
+    __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return __atomic_exchange_n(&s->signal, 0, __ATOMIC_SEQ_CST);
+}
+#else
 int equeue_sema_create(equeue_sema_t *s) {
     int err = pthread_mutex_init(&s->mutex, 0);
     if (err) {
         return err;
     }
 
+#if defined(EQUEUE_POSIX_MONOTONIC)
+    // timed waits need to use the same clock as the tick
+    pthread_condattr_t attr;
+    err = pthread_condattr_init(&attr);
+    if (err) {
+        return err;
+    }
+
+    err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (!err) {
+        err = pthread_cond_init(&s->cond, &attr);
+    }
+
+    pthread_condattr_destroy(&attr);
+    if (err) {
+        return err;
+    }
+#else
     err = pthread_cond_init(&s->cond, 0);
     if (err) {
         return err;
     }
+#endif
 
     s->signal = false;
     return 0;
@@ -67,18 +244,29 @@ void equeue_sema_signal(equeue_sema_t *s) {
     pthread_mutex_unlock(&s->mutex);
 }
 
-bool equeue_sema_wait(equeue_sema_t *s, int ms) {
+bool equeue_sema_wait(equeue_sema_t *s, int ticks) {
     pthread_mutex_lock(&s->mutex);
     if (!s->signal) {
-        if (ms < 0) {
+        if (ticks < 0) {
             pthread_cond_wait(&s->cond, &s->mutex);
         } else {
+            struct timespec now;
+#if defined(EQUEUE_POSIX_MONOTONIC)
+            clock_gettime(CLOCK_MONOTONIC, &now);
+#else
             struct timeval tv;
             gettimeofday(&tv, 0);
+            now.tv_sec = tv.tv_sec;
+            now.tv_nsec = tv.tv_usec*1000;
+#endif
 
+            // carry any overflowing nanoseconds into seconds
+            long nsec = (long)(ticks % (1000*EQUEUE_TICKS_PER_MS))
+                    * (1000000/EQUEUE_TICKS_PER_MS) + now.tv_nsec;
             struct timespec ts = {
-                .tv_sec = ms/1000 + tv.tv_sec,
-                .tv_nsec = ms*1000000 + tv.tv_usec*1000,
+                .tv_sec = ticks/(1000*EQUEUE_TICKS_PER_MS) + now.tv_sec
+                        + nsec/1000000000,
+                .tv_nsec = nsec % 1000000000,
             };
 
             pthread_cond_timedwait(&s->cond, &s->mutex, &ts);
@@ -91,5 +279,95 @@ bool equeue_sema_wait(equeue_sema_t *s, int ms) {
 
     return signal;
 }
+#endif
+
+
+// Atomic operations
+bool equeue_atomic_cas(void *volatile *ptr, void *expected, void *desired) {
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void *equeue_atomic_swap(void *volatile *ptr, void *desired) {
+    return __atomic_exchange_n(ptr, desired, __ATOMIC_SEQ_CST);
+}
+
+
+// Thread operations
+static void *equeue_thread_entry(void *p) {
+    equeue_thread_t *t = p;
+    t->func(t->data);
+    return 0;
+}
+
+int equeue_thread_create(equeue_thread_t *t,
+        void (*func)(void *), void *data) {
+    t->func = func;
+    t->data = data;
+    int err = pthread_create(&t->thread, 0, equeue_thread_entry, t);
+    return err ? -err : 0;
+}
+
+void equeue_thread_join(equeue_thread_t *t) {
+    pthread_join(t->thread, 0);
+}
+
+
+// Page operations
+//
+// Mappings with MAP_HUGETLB must be a multiple of the huge page size, which
+// can be overridden with EQUEUE_POSIX_HUGE_PAGE if the system's default
+// differs. If no huge pages are reserved, the map falls back to regular
+// pages and asks for transparent huge pages with madvise instead.
+#ifndef EQUEUE_POSIX_HUGE_PAGE
+#define EQUEUE_POSIX_HUGE_PAGE (2*1024*1024)
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+void *equeue_pages_map(size_t *size, bool huge, bool lock) {
+    void *buffer = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+    if (huge) {
+        size_t hsize = (*size + EQUEUE_POSIX_HUGE_PAGE-1)
+                & ~(size_t)(EQUEUE_POSIX_HUGE_PAGE-1);
+        buffer = mmap(0, hsize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buffer != MAP_FAILED) {
+            *size = hsize;
+        }
+    }
+#endif
+
+    if (buffer == MAP_FAILED) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        *size = (*size + page-1) & ~(page-1);
+        buffer = mmap(0, *size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            return 0;
+        }
+
+#if defined(MADV_HUGEPAGE)
+        if (huge) {
+            madvise(buffer, *size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    if (lock && mlock(buffer, *size) < 0) {
+        munmap(buffer, *size);
+        return 0;
+    }
+
+    return buffer;
+}
+
+void equeue_pages_unmap(void *buffer, size_t size) {
+    munlock(buffer, size);
+    munmap(buffer, size);
+}
 
 #endif
@@ -13,7 +13,15 @@
 
 // Tick operations
 unsigned equeue_tick(void) {
+#if defined(EQUEUE_TICK_US)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (unsigned)((count.QuadPart / freq.QuadPart) * 1000000 +
+            (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
     return GetTickCount();
+#endif
 }
 
 
@@ -50,13 +58,85 @@ void equeue_sema_signal(equeue_sema_t *s) {
     ReleaseSemaphore(*s, 1, NULL);
 }
 
-bool equeue_sema_wait(equeue_sema_t *s, int ms) {
-    if (ms < 0) {
+bool equeue_sema_wait(equeue_sema_t *s, int ticks) {
+    DWORD ms;
+    if (ticks < 0) {
         ms = INFINITE;
+    } else {
+        // round up to whole milliseconds
+        ms = ticks/EQUEUE_TICKS_PER_MS + (ticks % EQUEUE_TICKS_PER_MS != 0);
     }
 
     return WaitForSingleObject(*s, ms) == WAIT_OBJECT_0;
 }
 
 
+// Atomic operations
+bool equeue_atomic_cas(void *volatile *ptr, void *expected, void *desired) {
+    return InterlockedCompareExchangePointer(ptr, desired, expected)
+            == expected;
+}
+
+void *equeue_atomic_swap(void *volatile *ptr, void *desired) {
+    return InterlockedExchangePointer(ptr, desired);
+}
+
+
+// Thread operations
+static DWORD WINAPI equeue_thread_entry(LPVOID p) {
+    equeue_thread_t *t = p;
+    t->func(t->data);
+    return 0;
+}
+
+int equeue_thread_create(equeue_thread_t *t,
+        void (*func)(void *), void *data) {
+    t->func = func;
+    t->data = data;
+    t->thread = CreateThread(NULL, 0, equeue_thread_entry, t, 0, NULL);
+    return t->thread ? 0 : -1;
+}
+
+void equeue_thread_join(equeue_thread_t *t) {
+    WaitForSingleObject(t->thread, INFINITE);
+    CloseHandle(t->thread);
+}
+
+
+// Page operations
+//
+// Large pages need the SeLockMemoryPrivilege and are never paged out, so
+// they already satisfy lock. Without the privilege the map falls back to
+// regular pages.
+void *equeue_pages_map(size_t *size, bool huge, bool lock) {
+    SIZE_T large = huge ? GetLargePageMinimum() : 0;
+    if (large) {
+        SIZE_T lsize = (*size + large-1) & ~(large-1);
+        void *buffer = VirtualAlloc(0, lsize,
+                MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (buffer) {
+            *size = lsize;
+            return buffer;
+        }
+    }
+
+    void *buffer = VirtualAlloc(0, *size,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!buffer) {
+        return 0;
+    }
+
+    if (lock && !VirtualLock(buffer, *size)) {
+        VirtualFree(buffer, 0, MEM_RELEASE);
+        return 0;
+    }
+
+    return buffer;
+}
+
+void equeue_pages_unmap(void *buffer, size_t size) {
+    VirtualFree(buffer, 0, MEM_RELEASE);
+}
+
+
 #endif
@@ -139,6 +139,70 @@ void equeue_alloc_prof(void) {
     equeue_destroy(&q);
 }
 
+// a bump allocator with a single free list for equally sized chunks, to
+// compare against the built-in allocator, the free list lives after the
+// header of each free chunk
+struct prof_allocator {
+    unsigned char *slab;
+    size_t size;
+    void *chunks;
+};
+
+void prof_allocator_attach(void *ctx, void *buffer, size_t size) {
+    struct prof_allocator *a = ctx;
+    a->slab = buffer;
+    a->size = size;
+}
+
+void *prof_allocator_alloc(void *ctx, size_t size) {
+    struct prof_allocator *a = ctx;
+    if (a->chunks) {
+        void *chunk = a->chunks;
+        a->chunks = *(void **)((struct equeue_event *)chunk + 1);
+        return chunk;
+    }
+
+    if (a->size < size) {
+        return 0;
+    }
+
+    void *chunk = a->slab;
+    a->slab += size;
+    a->size -= size;
+    return chunk;
+}
+
+void prof_allocator_dealloc(void *ctx, void *chunk, size_t size) {
+    struct prof_allocator *a = ctx;
+    *(void **)((struct equeue_event *)chunk + 1) = a->chunks;
+    a->chunks = chunk;
+}
+
+void equeue_alloc_plugged_prof(void) {
+    struct equeue q;
+    equeue_create(&q, 32*EQUEUE_EVENT_SIZE);
+
+    struct prof_allocator a = {0};
+    const equeue_allocator_t allocator = {
+        prof_allocator_attach,
+        prof_allocator_alloc,
+        prof_allocator_dealloc,
+        0,
+        0,
+    };
+    equeue_allocator(&q, &allocator, &a);
+
+    prof_loop() {
+        prof_start();
+        void *e = equeue_alloc(&q, 8 * sizeof(int));
+        prof_stop();
+
+        equeue_dealloc(&q, e);
+    }
+
+    equeue_destroy(&q);
+}
+
 void equeue_alloc_many_prof(int count) {
     struct equeue q;
     equeue_create(&q, count*EQUEUE_EVENT_SIZE);
@@ -164,6 +228,31 @@ void equeue_alloc_many_prof(int count) {
     equeue_destroy(&q);
 }
 
+void equeue_alloc_many_sizes_prof(int count) {
+    struct equeue q;
+    equeue_create(&q, count*(EQUEUE_EVENT_SIZE + count*sizeof(void*)));
+
+    void *es[count];
+
+    for (int i = 0; i < count; i++) {
+        es[i] = equeue_alloc(&q, i * sizeof(void*));
+    }
+
+    for (int i = 0; i < count; i++) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+    prof_loop() {
+        prof_start();
+        void *e = equeue_alloc(&q, (count-1) * sizeof(void*));
+        prof_stop();
+
+        equeue_dealloc(&q, e);
+    }
+
+    equeue_destroy(&q);
+}
+
 void equeue_post_prof(void) {
     struct equeue q;
     equeue_create(&q, EQUEUE_EVENT_SIZE);
@@ -202,6 +291,26 @@ void equeue_post_many_prof(int count) {
     equeue_destroy(&q);
 }
 
+void equeue_post_batch_prof(int count) {
+    struct equeue q;
+    equeue_create(&q, count*EQUEUE_EVENT_SIZE);
+
+    void **es = malloc(count*sizeof(void*));
+
+    prof_loop() {
+        int n = equeue_alloc_batch(&q, 0, es, count);
+
+        prof_start();
+        equeue_post_batch(&q, no_func, es, 0, n);
+        prof_stop();
+
+        equeue_dispatch(&q, 0);
+    }
+
+    free(es);
+    equeue_destroy(&q);
+}
+
 void equeue_post_future_prof(void) {
     struct equeue q;
     equeue_create(&q, EQUEUE_EVENT_SIZE);
@@ -377,13 +486,16 @@ int main() {
 
     prof_measure(equeue_tick_prof);
     prof_measure(equeue_alloc_prof);
+    prof_measure(equeue_alloc_plugged_prof);
     prof_measure(equeue_post_prof);
     prof_measure(equeue_post_future_prof);
     prof_measure(equeue_dispatch_prof);
     prof_measure(equeue_cancel_prof);
 
     prof_measure(equeue_alloc_many_prof, 1000);
+    prof_measure(equeue_alloc_many_sizes_prof, 100);
     prof_measure(equeue_post_many_prof, 1000);
+    prof_measure(equeue_post_batch_prof, 100);
     prof_measure(equeue_post_future_many_prof, 1000);
     prof_measure(equeue_dispatch_many_prof, 100);
     prof_measure(equeue_cancel_many_prof, 100);
@@ -38,6 +38,23 @@ static int test_failure;
     }                                                                       \
 })
 
+// Memory taken by an event with a payload, aligned events round the payload
+// up to a cache line
+#if defined(EQUEUE_CACHE_ALIGNED)
+#define TEST_EVENT_SIZE(size) (EQUEUE_EVENT_SIZE + \
+        (((size) + EQUEUE_CACHE_LINE-1) & ~(EQUEUE_CACHE_LINE-1)))
+#else
+#define TEST_EVENT_SIZE(size) (EQUEUE_EVENT_SIZE + (size))
+#endif
+
+// Memory each allocating thread may hold in its cache, if any
+#if defined(EQUEUE_THREAD_CACHE)
+#define TEST_THREAD_SIZE (sizeof(struct equeue_cache) + \
+        (EQUEUE_CACHE_LIMIT+1)*EQUEUE_EVENT_SIZE)
+#else
+#define TEST_THREAD_SIZE 0
+#endif
+
 
 // Test functions
 void pass_func(void *eh) {
@@ -72,7 +89,7 @@ void timing_func(void *p) {
     unsigned tick = equeue_tick();
 
     unsigned t1 = timing->delay;
-    unsigned t2 = tick - timing->tick;
+    unsigned t2 = (tick - timing->tick) / EQUEUE_TICKS_PER_MS;
     test_assert(t1 > t2 - 100 && t1 < t2 + 100);
 
     timing->tick = tick;
@@ -121,6 +138,17 @@ void nest_func(void *p) {
     usleep(100000);
 }
 
+struct order {
+    int *log;
+    int *count;
+    int i;
+};
+
+void order_func(void *p) {
+    struct order *order = (struct order *)p;
+    order->log[(*order->count)++] = order->i;
+}
+
 
 // Simple call tests
 void simple_call_test(void) {
@@ -250,7 +278,12 @@ void allocation_failure_test(void) {
     void *p = equeue_alloc(&q, 4096);
     test_assert(!p);
 
+    // growable queues first fill all of their regions
+#if defined(EQUEUE_GROWABLE)
+    for (int i = 0; i < 100*EQUEUE_REGIONS; i++) {
+#else
     for (int i = 0; i < 100; i++) {
+#endif
         p = equeue_alloc(&q, 0);
     }
     test_assert(!p);
@@ -258,6 +291,517 @@ void allocation_failure_test(void) {
     equeue_destroy(&q);
 }
 
+void allocation_reuse_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*(EQUEUE_EVENT_SIZE + N*sizeof(void*)));
+    test_assert(!err);
+
+    void **es = malloc(N*sizeof(void*));
+    for (int i = 0; i < N; i++) {
+        es[i] = equeue_alloc(&q, i*sizeof(void*));
+        test_assert(es[i]);
+    }
+
+    // reallocating the same sizes should not need any more memory
+    size_t size = q.slab.size;
+    for (int i = 0; i < N; i++) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+    for (int i = N-1; i >= 0; i--) {
+        es[i] = equeue_alloc(&q, i*sizeof(void*));
+        test_assert(es[i]);
+    }
+    test_assert(q.slab.size == size);
+
+    for (int i = 0; i < N; i++) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+    free(es);
+    equeue_destroy(&q);
+}
+
+void allocation_coalesce_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*EQUEUE_EVENT_SIZE);
+    test_assert(!err);
+
+    void **es = malloc(N*sizeof(void*));
+    int count = 0;
+    while (count < N && (es[count] = equeue_alloc(&q, 0))) {
+        count++;
+    }
+    test_assert(count > 0);
+
+    for (int i = 0; i < count; i += 2) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+    for (int i = 1; i < count; i += 2) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+    // the freed events should still be available as small events
+    for (int i = 0; i < count; i++) {
+        es[i] = equeue_alloc(&q, 0);
+        test_assert(es[i]);
+    }
+
+    for (int i = count-1; i >= 0; i--) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+#if defined(EQUEUE_ALLOCATOR_COALESCE)
+    // and merge back into a single large event
+    void *e = equeue_alloc(&q, N*EQUEUE_EVENT_SIZE/2);
+    test_assert(e);
+    equeue_dealloc(&q, e);
+#endif
+
+    free(es);
+    equeue_destroy(&q);
+}
+
+void allocation_mixed_test(int N) {
+    equeue_t q;
+#if defined(EQUEUE_ALLOCATOR_BINS) && !defined(EQUEUE_ALLOCATOR_COALESCE)
+    // without coalescing, shared size classes may strand memory
+    int err = equeue_create(&q, 4*N*(EQUEUE_EVENT_SIZE + 32*sizeof(void*)));
+#else
+    int err = equeue_create(&q, N*(EQUEUE_EVENT_SIZE + 32*sizeof(void*)));
+#endif
+    test_assert(!err);
+
+    uint8_t **es = calloc(N, sizeof(uint8_t*));
+    size_t *sizes = calloc(N, sizeof(size_t));
+    unsigned seed = 1;
+
+    // churn events of mixed sizes, checking that no event is corrupted
+    for (int i = 0; i < 64*N; i++) {
+        seed = seed*1103515245 + 12345;
+        int j = (seed >> 16) % N;
+        if (es[j]) {
+            for (size_t k = 0; k < sizes[j]; k++) {
+                test_assert(es[j][k] == (uint8_t)j);
+            }
+
+            equeue_dealloc(&q, es[j]);
+            es[j] = 0;
+        } else {
+            sizes[j] = (seed >> 8) % (32*sizeof(void*));
+            es[j] = equeue_alloc(&q, sizes[j]);
+            test_assert(es[j]);
+            for (size_t k = 0; k < sizes[j]; k++) {
+                es[j][k] = (uint8_t)j;
+            }
+        }
+    }
+
+    for (int j = 0; j < N; j++) {
+        if (es[j]) {
+            equeue_dealloc(&q, es[j]);
+        }
+    }
+
+    free(es);
+    free(sizes);
+    equeue_destroy(&q);
+}
+
+void allocation_pool_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*EQUEUE_EVENT_SIZE);
+    test_assert(!err);
+
+    int touched = 0;
+    int count = 0;
+    while (equeue_call(&q, simple_func, &touched)) {
+        count++;
+    }
+    test_assert(count >= N/2);
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == count);
+
+    // freed events should be reusable by equeue_call
+    for (int i = 0; i < count; i++) {
+        int id = equeue_call(&q, simple_func, &touched);
+        test_assert(id);
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 2*count);
+
+    // and by smaller events
+    for (int i = 0; i < count; i++) {
+        void *e = equeue_alloc(&q, 0);
+        test_assert(e);
+    }
+
+    equeue_destroy(&q);
+}
+
+void extend_test(int N) {
+    equeue_t q;
+    uint8_t buffer[2048];
+    int err = equeue_create_inplace(&q, sizeof(buffer), buffer);
+    test_assert(!err);
+
+    int touched = 0;
+    int count = 0;
+    while (equeue_call_in(&q, 10, simple_func, &touched)) {
+        count++;
+    }
+    test_assert(count > 0);
+
+#if defined(EQUEUE_GROWABLE)
+    uint8_t *extension = malloc(N*EQUEUE_EVENT_SIZE);
+    err = equeue_extend(&q, N*EQUEUE_EVENT_SIZE, extension);
+    test_assert(!err);
+
+    // events in the new region should work like any other event
+    int *ids = malloc(N*sizeof(int));
+    for (int i = 0; i < N/2; i++) {
+        ids[i] = equeue_call_in(&q, 10, simple_func, &touched);
+        test_assert(ids[i]);
+        test_assert(equeue_timeleft(&q, ids[i]) > 0);
+    }
+
+    for (int i = 0; i < N/2; i += 2) {
+        equeue_cancel(&q, ids[i]);
+    }
+
+    equeue_dispatch(&q, 20);
+    test_assert(touched == count + N/4);
+
+    free(ids);
+    equeue_destroy(&q);
+    free(extension);
+#else
+    err = equeue_extend(&q, 2048, 0);
+    test_assert(err < 0);
+
+    equeue_dispatch(&q, 20);
+    test_assert(touched == count);
+
+    equeue_destroy(&q);
+#endif
+}
+
+void grow_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*EQUEUE_EVENT_SIZE);
+    test_assert(!err);
+
+    // queues created with equeue_create should grow as needed
+    int touched = 0;
+    int count = 0;
+    while (count < 4*N && equeue_call(&q, simple_func, &touched)) {
+        count++;
+    }
+
+#if defined(EQUEUE_GROWABLE)
+    test_assert(count == 4*N);
+#else
+    test_assert(count < 4*N);
+#endif
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == count);
+
+    equeue_destroy(&q);
+
+#if defined(EQUEUE_GROWABLE)
+    // attached regions too small for an event shouldn't stop the queue
+    // from growing
+    err = equeue_create(&q, N*EQUEUE_EVENT_SIZE);
+    test_assert(!err);
+
+    uint8_t buffer[EQUEUE_EVENT_SIZE];
+    err = equeue_extend(&q, sizeof(buffer), buffer);
+    test_assert(!err);
+
+    count = 0;
+    while (count < 2*N && equeue_alloc(&q, EQUEUE_EVENT_SIZE)) {
+        count++;
+    }
+    test_assert(count == 2*N);
+
+    equeue_destroy(&q);
+#endif
+}
+
+void create_flags_test(int N) {
+    int flags[] = {
+        0,
+        EQUEUE_CREATE_PREFAULT,
+        EQUEUE_CREATE_HUGEPAGES,
+        EQUEUE_CREATE_LOCKED,
+        EQUEUE_CREATE_HUGEPAGES | EQUEUE_CREATE_PREFAULT,
+    };
+
+    for (unsigned i = 0; i < sizeof(flags)/sizeof(flags[0]); i++) {
+        equeue_t q;
+        int err = equeue_create_flags(&q,
+                N*EQUEUE_EVENT_SIZE + TEST_THREAD_SIZE, flags[i]);
+        test_assert(!err);
+
+        // the buffer may be rounded up, but should fit at least N events
+        int touched = 0;
+        int count = 0;
+        while (count < 2*N && equeue_call(&q, simple_func, &touched)) {
+            count++;
+        }
+
+#if defined(EQUEUE_GROWABLE)
+        test_assert(count == 2*N);
+#else
+        test_assert(count >= N);
+#endif
+
+        equeue_dispatch(&q, 0);
+        test_assert(touched == count);
+
+        equeue_destroy(&q);
+    }
+}
+
+// a simple pluggable allocator, carves chunks out of the regions it is
+// given and reuses freed chunks of the same size
+struct test_allocator {
+    unsigned char *slab;
+    size_t size;
+    void *chunks[64];
+    size_t sizes[64];
+    int count;
+    int allocs;
+    int deallocs;
+};
+
+void test_allocator_attach(void *ctx, void *buffer, size_t size) {
+    struct test_allocator *a = ctx;
+    a->slab = buffer;
+    a->size = size;
+}
+
+void *test_allocator_alloc(void *ctx, size_t size) {
+    struct test_allocator *a = ctx;
+    a->allocs += 1;
+    for (int i = 0; i < a->count; i++) {
+        if (a->sizes[i] == size) {
+            void *chunk = a->chunks[i];
+            a->count -= 1;
+            a->chunks[i] = a->chunks[a->count];
+            a->sizes[i] = a->sizes[a->count];
+            return chunk;
+        }
+    }
+
+    if (a->size < size) {
+        return 0;
+    }
+
+    void *chunk = a->slab;
+    a->slab += size;
+    a->size -= size;
+    return chunk;
+}
+
+void test_allocator_dealloc(void *ctx, void *chunk, size_t size) {
+    struct test_allocator *a = ctx;
+    a->deallocs += 1;
+    if (a->count < 64) {
+        a->chunks[a->count] = chunk;
+        a->sizes[a->count] = size;
+        a->count += 1;
+    }
+}
+
+void allocator_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*EQUEUE_EVENT_SIZE + TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    struct test_allocator a = {0};
+    const equeue_allocator_t allocator = {
+        test_allocator_attach,
+        test_allocator_alloc,
+        test_allocator_dealloc,
+        0,
+        0,
+    };
+
+    err = equeue_allocator(&q, &allocator, &a);
+#if defined(EQUEUE_SCHEDULER_HEAP) || defined(EQUEUE_ALLOCATOR_COALESCE)
+    test_assert(err < 0);
+    equeue_destroy(&q);
+    return;
+#endif
+    test_assert(!err);
+    test_assert(a.slab && a.size > 0);
+
+    // events should come from the pluggable allocator, and go back to it
+    // once dispatched
+    int touched = 0;
+    int *ids = malloc(N*sizeof(int));
+    for (int i = 0; i < N; i++) {
+        ids[i] = equeue_call(&q, simple_func, &touched);
+        test_assert(ids[i]);
+    }
+    test_assert(a.allocs == N);
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == N);
+    test_assert(a.deallocs == N);
+
+    // reused chunks should not be cancelled by stale ids
+    size_t left = a.size;
+    for (int i = 0; i < N; i++) {
+        int id = equeue_call_in(&q, 10, simple_func, &touched);
+        test_assert(id);
+        for (int j = 0; j < N; j++) {
+            test_assert(id != ids[j]);
+        }
+    }
+    test_assert(a.allocs == 2*N);
+    test_assert(a.size == left);
+
+    for (int i = 0; i < N; i++) {
+        equeue_cancel(&q, ids[i]);
+    }
+
+    equeue_dispatch(&q, 20);
+    test_assert(touched == 2*N);
+    test_assert(a.deallocs == 2*N);
+
+    // the allocator can only be replaced before events are allocated
+    test_assert(equeue_allocator(&q, &allocator, &a) < 0);
+
+    free(ids);
+    equeue_destroy(&q);
+}
+
+void id64_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*EQUEUE_EVENT_SIZE + TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    // handles should work the same as int ids
+    int touched = 0;
+    equeue_id64_t *ids = malloc(N*sizeof(equeue_id64_t));
+    for (int i = 0; i < N; i++) {
+        ids[i] = equeue_call_in_id64(&q, 10, simple_func, &touched);
+        test_assert(ids[i]);
+        test_assert(equeue_timeleft_id64(&q, ids[i]) > 0);
+    }
+
+    for (int i = 0; i < N; i += 2) {
+        equeue_cancel_id64(&q, ids[i]);
+    }
+
+    equeue_dispatch(&q, 20);
+    test_assert(touched == N/2);
+
+    // cycle an event through more local ids than fit in a byte, a stale
+    // handle must not cancel the event that reuses its slot
+    equeue_id64_t stale = equeue_call_id64(&q, simple_func, &touched);
+    test_assert(stale);
+    equeue_cancel_id64(&q, stale);
+    for (int i = 0; i < 300; i++) {
+        equeue_cancel_id64(&q, equeue_call_id64(&q, simple_func, &touched));
+        equeue_dispatch(&q, 0);
+    }
+
+    equeue_id64_t id = equeue_call_id64(&q, simple_func, &touched);
+    test_assert(id);
+#if defined(EQUEUE_WIDE_IDS)
+    test_assert(id != stale);
+    equeue_cancel_id64(&q, stale);
+#endif
+    equeue_dispatch(&q, 0);
+    test_assert(touched == N/2 + 1);
+
+    free(ids);
+    equeue_destroy(&q);
+}
+
+void event_size_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*EQUEUE_EVENT_SIZE + TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    // EQUEUE_EVENT_SIZE should fit each equeue_call event
+    int touched = 0;
+    for (int i = 0; i < N; i++) {
+        test_assert(equeue_call(&q, simple_func, &touched));
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == N);
+    equeue_destroy(&q);
+
+    // events with a period, destructor and slack should keep all three
+    err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    touched = 0;
+    struct indirect *e = equeue_alloc(&q, sizeof(struct indirect));
+    test_assert(e);
+    e->touched = &touched;
+    equeue_event_delay(e, 10);
+    equeue_event_period(e, 10);
+    equeue_event_slack(e, 1);
+    equeue_event_dtor(e, indirect_func);
+    int id = equeue_post(&q, indirect_func, e);
+    test_assert(id);
+
+    equeue_dispatch(&q, 35);
+    test_assert(touched >= 2);
+
+    int fired = touched;
+    equeue_cancel(&q, id);
+    test_assert(touched == fired + 1);
+
+    equeue_destroy(&q);
+}
+
+void cache_aligned_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*TEST_EVENT_SIZE(1) + TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    // events should not share cache lines
+    char **es = malloc(N*sizeof(char*));
+    for (int i = 0; i < N; i++) {
+        es[i] = equeue_alloc(&q, 1);
+        test_assert(es[i]);
+#if defined(EQUEUE_CACHE_ALIGNED)
+        test_assert((uintptr_t)es[i] % EQUEUE_CACHE_LINE ==
+                sizeof(struct equeue_event) % EQUEUE_CACHE_LINE);
+        for (int j = 0; j < i; j++) {
+            test_assert((uintptr_t)es[i] / EQUEUE_CACHE_LINE !=
+                    (uintptr_t)es[j] / EQUEUE_CACHE_LINE);
+        }
+#endif
+    }
+
+#if defined(EQUEUE_SCHEDULER_HEAP)
+    // the children of each heap node should share a cache line
+    if (EQUEUE_CACHE_LINE == 4*sizeof(struct equeue_heap_entry)) {
+        test_assert((uintptr_t)q.heap.entries % EQUEUE_CACHE_LINE == 0);
+    }
+#endif
+
+    for (int i = 0; i < N; i++) {
+        equeue_dealloc(&q, es[i]);
+    }
+
+    free(es);
+
+    equeue_destroy(&q);
+}
+
 void cancel_test(int N) {
     equeue_t q;
     int err = equeue_create(&q, 2048);
@@ -317,6 +861,44 @@ void cancel_inflight_test(void) {
     equeue_destroy(&q);
 }
 
+void cancel_ready_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int log[4];
+    int count = 0;
+    int ids[4];
+
+    for (int i = 0; i < 3; i++) {
+        struct order *order = equeue_alloc(&q, sizeof(struct order));
+        test_assert(order);
+        order->log = log;
+        order->count = &count;
+        order->i = i;
+        ids[i] = equeue_post(&q, order_func, order);
+        test_assert(ids[i]);
+        test_assert(equeue_timeleft(&q, ids[i]) == 0);
+    }
+
+    equeue_cancel(&q, ids[1]);
+    equeue_cancel(&q, ids[2]);
+
+    struct order *order = equeue_alloc(&q, sizeof(struct order));
+    test_assert(order);
+    order->log = log;
+    order->count = &count;
+    order->i = 3;
+    ids[3] = equeue_post(&q, order_func, order);
+    test_assert(ids[3]);
+
+    equeue_dispatch(&q, 0);
+    test_assert(count == 2);
+    test_assert(log[0] == 0 && log[1] == 3);
+
+    equeue_destroy(&q);
+}
+
 void cancel_unnecessarily_test(void) {
     equeue_t q;
     int err = equeue_create(&q, 2048);
@@ -414,17 +996,90 @@ void period_test(void) {
     equeue_destroy(&q);
 }
 
-void nested_test(void) {
+struct slack {
+    unsigned start;
+    unsigned *ticks;
+    int *count;
+};
+
+void slack_func(void *p) {
+    struct slack *slack = (struct slack *)p;
+    slack->ticks[(*slack->count)++] =
+            (equeue_tick() - slack->start) / EQUEUE_TICKS_PER_MS;
+}
+
+void slack_test(void) {
     equeue_t q;
-    int err = equeue_create(&q, 2048);
+    int err = equeue_create(&q, 50*TEST_EVENT_SIZE(sizeof(struct slack)));
     test_assert(!err);
 
-    int touched = 0;
-    struct nest *nest = equeue_alloc(&q, sizeof(struct nest));
-    test_assert(nest);
-    nest->q = &q;
-    nest->cb = simple_func;
-    nest->data = &touched;
+    unsigned ticks[50];
+    int count = 0;
+    struct slack slack = {equeue_tick(), ticks, &count};
+
+    for (int i = 0; i < 50; i++) {
+        int id = equeue_call_in_slack(&q, i+1, 100, slack_func, &slack);
+        test_assert(id);
+    }
+
+    equeue_dispatch(&q, 300);
+    test_assert(count == 50);
+
+    // nearby deadlines should be coalesced into only a few wakeups
+    int wakeups = 1;
+    for (int i = 0; i < 50; i++) {
+        test_assert(ticks[i] >= 1 && ticks[i] <= 50+100+20);
+        if (i > 0 && ticks[i] != ticks[i-1]) {
+            wakeups += 1;
+        }
+    }
+    test_assert(wakeups <= 4);
+
+    equeue_destroy(&q);
+}
+
+void microsecond_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    bool touched = false;
+    int id = equeue_call_in_us(&q, 1500, simple_func, &touched);
+    test_assert(id);
+
+    int left = equeue_timeleft_us(&q, id);
+    test_assert(left > 0 && left <= 2000);
+    test_assert(equeue_timeleft(&q, id) == 2 ||
+            equeue_timeleft(&q, id) == 1);
+
+    int count = 0;
+    id = equeue_call_every_us(&q, 250, simple_func, &count);
+    test_assert(id);
+
+    equeue_dispatch(&q, 20);
+    test_assert(touched);
+#if defined(EQUEUE_POSIX_COARSE_CLOCK)
+    // the coarse clock only moves every timer interrupt, up to 10ms apart,
+    // and periodic events don't fire more often than the clock moves
+    test_assert(count >= 2);
+#else
+    test_assert(count >= 10);
+#endif
+
+    equeue_destroy(&q);
+}
+
+void nested_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int touched = 0;
+    struct nest *nest = equeue_alloc(&q, sizeof(struct nest));
+    test_assert(nest);
+    nest->q = &q;
+    nest->cb = simple_func;
+    nest->data = &touched;
 
     int id = equeue_post(&q, nest_func, nest);
     test_assert(id);
@@ -500,6 +1155,520 @@ void multithread_test(void) {
     equeue_destroy(&q);
 }
 
+struct workers {
+    pthread_mutex_t mutex;
+    int count;
+    int running;
+    int concurrent;
+};
+
+void workers_func(void *p) {
+    struct workers *w = (struct workers *)p;
+    pthread_mutex_lock(&w->mutex);
+    w->count += 1;
+    w->running += 1;
+    if (w->running > w->concurrent) {
+        w->concurrent = w->running;
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+    usleep(1000);
+
+    pthread_mutex_lock(&w->mutex);
+    w->running -= 1;
+    pthread_mutex_unlock(&w->mutex);
+}
+
+#if defined(EQUEUE_WORKERS)
+void repost_func(void *p) {
+    equeue_t *q = (equeue_t *)p;
+    test_assert(equeue_call(q, repost_func, q));
+}
+
+void *workers_thread(void *p) {
+    equeue_dispatch_workers((equeue_t *)p, 4, -1);
+    return 0;
+}
+
+void dispatch_workers_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, 2*N*EQUEUE_EVENT_SIZE + 5*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    struct workers w = {.count = 0};
+    pthread_mutex_init(&w.mutex, 0);
+
+    // independent events should run on several threads at once
+    for (int i = 0; i < N; i++) {
+        test_assert(equeue_call(&q, workers_func, &w));
+    }
+
+    // periodic events should keep firing and cancelled events never run
+    int touched = 0;
+    test_assert(equeue_call_every(&q, 10, simple_func, &touched));
+    int cancelled = 0;
+    int id = equeue_call_in(&q, 10, simple_func, &cancelled);
+    test_assert(id);
+    equeue_cancel(&q, id);
+
+    equeue_dispatch_workers(&q, 4, 55);
+    test_assert(w.count == N);
+    test_assert(w.concurrent > 1);
+    test_assert(touched >= 4);
+    test_assert(!cancelled);
+
+    // equeue_break should stop every worker
+    pthread_t thread;
+    err = pthread_create(&thread, 0, workers_thread, &q);
+    test_assert(!err);
+
+    usleep(10000);
+    equeue_break(&q);
+    err = pthread_join(thread, 0);
+    test_assert(!err);
+
+    // events that keep reposting themselves shouldn't hold off the timeout
+    for (int i = 0; i < 8; i++) {
+        test_assert(equeue_call(&q, repost_func, &q));
+    }
+
+    for (int n = 1; n <= 4; n *= 2) {
+        unsigned tick = equeue_tick();
+        equeue_dispatch_workers(&q, n, 20);
+        test_assert((equeue_tick() - tick) / EQUEUE_TICKS_PER_MS < 60);
+    }
+
+    // or equeue_break
+    err = pthread_create(&thread, 0, workers_thread, &q);
+    test_assert(!err);
+
+    usleep(10000);
+    equeue_break(&q);
+    err = pthread_join(thread, 0);
+    test_assert(!err);
+
+    pthread_mutex_destroy(&w.mutex);
+    equeue_destroy(&q);
+}
+#endif
+
+#if defined(EQUEUE_STRANDS)
+struct strand_state {
+    struct workers *w;
+    volatile int running;
+    int count;
+    bool broken;
+};
+
+struct strand_call {
+    struct strand_state *state;
+    int seq;
+};
+
+void strand_func(void *p) {
+    struct strand_call *c = (struct strand_call *)p;
+    struct strand_state *st = c->state;
+    if (st->running || c->seq != st->count) {
+        st->broken = true;
+    }
+
+    st->running = 1;
+    st->count += 1;
+    workers_func(st->w);
+    st->running = 0;
+}
+
+void strand_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, 8*N*EQUEUE_EVENT_SIZE + 5*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    struct workers w = {.count = 0};
+    pthread_mutex_init(&w.mutex, 0);
+
+    // calls on a strand should run one at a time and in order, while
+    // different strands run in parallel
+    equeue_strand_t strands[4];
+    struct strand_state states[4];
+    struct strand_call calls[4][N];
+    for (int i = 0; i < 4; i++) {
+        err = equeue_strand_create(&strands[i], &q);
+        test_assert(!err);
+        states[i] = (struct strand_state){.w = &w};
+    }
+
+    for (int j = 0; j < N; j++) {
+        for (int i = 0; i < 4; i++) {
+            calls[i][j] = (struct strand_call){&states[i], j};
+            err = equeue_strand_call(&strands[i], strand_func, &calls[i][j]);
+            test_assert(!err);
+        }
+    }
+
+#if defined(EQUEUE_WORKERS)
+    equeue_dispatch_workers(&q, 4, 10*N);
+#else
+    equeue_dispatch(&q, 10*N);
+#endif
+    for (int i = 0; i < 4; i++) {
+        test_assert(states[i].count == N);
+        test_assert(!states[i].broken);
+    }
+    test_assert(w.count == 4*N);
+#if defined(EQUEUE_WORKERS)
+    test_assert(w.concurrent > 1);
+#endif
+
+    // strands may be destroyed with calls waiting once the queue is no
+    // longer dispatched
+    for (int j = 0; j < N; j++) {
+        err = equeue_strand_call(&strands[0], strand_func, &calls[0][j]);
+        test_assert(!err);
+    }
+    test_assert(states[0].count == N);
+
+    for (int i = 0; i < 4; i++) {
+        equeue_strand_destroy(&strands[i]);
+    }
+    pthread_mutex_destroy(&w.mutex);
+    equeue_destroy(&q);
+}
+#endif
+
+#if defined(EQUEUE_OFFLOAD)
+struct offload_state {
+    pthread_mutex_t mutex;
+    pthread_t dispatcher;
+    int worked;
+    int done;
+    bool wrong_thread;
+};
+
+void offload_work(void *p) {
+    struct offload_state *st = (struct offload_state *)p;
+    usleep(1000);
+
+    pthread_mutex_lock(&st->mutex);
+    st->worked += 1;
+    if (pthread_equal(pthread_self(), st->dispatcher)) {
+        st->wrong_thread = true;
+    }
+    pthread_mutex_unlock(&st->mutex);
+}
+
+void offload_done(void *p) {
+    struct offload_state *st = (struct offload_state *)p;
+    pthread_mutex_lock(&st->mutex);
+    st->done += 1;
+    if (!pthread_equal(pthread_self(), st->dispatcher)) {
+        st->wrong_thread = true;
+    }
+    pthread_mutex_unlock(&st->mutex);
+}
+
+void offload_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, 4*N*EQUEUE_EVENT_SIZE + 3*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    struct offload_state st = {.worked = 0};
+    pthread_mutex_init(&st.mutex, 0);
+    st.dispatcher = pthread_self();
+
+    equeue_offload_t pool;
+    err = equeue_offload_create(&pool, &q, 2);
+    test_assert(!err);
+
+    // work should run off the dispatch thread, done functions on it, while
+    // the dispatch loop keeps running other events
+    for (int i = 0; i < N; i++) {
+        err = equeue_offload(&pool, offload_work, offload_done, &st);
+        test_assert(!err);
+    }
+
+    int touched = 0;
+    test_assert(equeue_call_every(&q, 1, simple_func, &touched));
+    equeue_dispatch(&q, 10*N);
+    test_assert(st.worked == N);
+    test_assert(st.done == N);
+    test_assert(!st.wrong_thread);
+    test_assert(touched > N);
+
+    // destroying the pool should finish offloaded work first
+    for (int i = 0; i < N; i++) {
+        err = equeue_offload(&pool, offload_work, offload_done, &st);
+        test_assert(!err);
+    }
+    test_assert(!equeue_offload(&pool, offload_work, 0, &st));
+
+    equeue_offload_destroy(&pool);
+    test_assert(st.worked == 2*N+1);
+
+    equeue_dispatch(&q, 0);
+    test_assert(st.done == 2*N);
+    test_assert(!st.wrong_thread);
+
+    pthread_mutex_destroy(&st.mutex);
+    equeue_destroy(&q);
+}
+#endif
+
+#if defined(EQUEUE_GROUPS)
+struct group_dispatcher {
+    equeue_group_t *g;
+    unsigned shard;
+};
+
+void *group_thread(void *p) {
+    struct group_dispatcher *d = (struct group_dispatcher *)p;
+    equeue_group_dispatch(d->g, d->shard, -1);
+    return 0;
+}
+
+void group_test(int N) {
+    equeue_group_t g;
+    int err = equeue_group_create(&g, 4,
+            2*N*EQUEUE_EVENT_SIZE + 2*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    // group ids should work with cancel and timeleft
+    int touched = 0;
+    equeue_id64_t id = equeue_group_call_in(&g, 100, simple_func, &touched);
+    test_assert(id);
+    test_assert(equeue_group_timeleft(&g, id) > 0);
+    equeue_group_cancel(&g, id);
+#if !defined(EQUEUE_INTAKE)
+    test_assert(equeue_group_timeleft(&g, id) < 0);
+#endif
+
+    // a dispatcher with nothing to do should steal events from other shards
+    equeue_t *local = equeue_group_local(&g);
+    unsigned shard = (unsigned)(local - g.shards);
+    for (int i = 0; i < N; i++) {
+        test_assert(equeue_group_call(&g, simple_func, &touched));
+    }
+
+    equeue_group_dispatch(&g, (shard + 1) % 4, 20);
+    test_assert(touched == N);
+
+    // each shard dispatched by its own thread, until broken
+    pthread_t threads[4];
+    struct group_dispatcher ds[4];
+    for (int i = 0; i < 4; i++) {
+        ds[i].g = &g;
+        ds[i].shard = i;
+        err = pthread_create(&threads[i], 0, group_thread, &ds[i]);
+        test_assert(!err);
+    }
+
+    for (int i = 0; i < N; i++) {
+        test_assert(equeue_group_call(&g, simple_func, &touched));
+    }
+
+    usleep(20000);
+    equeue_group_break(&g);
+    for (int i = 0; i < 4; i++) {
+        err = pthread_join(threads[i], 0);
+        test_assert(!err);
+    }
+
+    test_assert(touched == 2*N);
+
+    // an idle dispatcher should be woken to steal calls posted to a busy
+    // shard without waiting for its poll, dispatching a shard made it this
+    // thread's local shard
+    shard = (unsigned)(equeue_group_local(&g) - g.shards);
+    ds[0].shard = (shard + 1) % 4;
+    err = pthread_create(&threads[0], 0, group_thread, &ds[0]);
+    test_assert(!err);
+
+    usleep(10000);
+    for (int i = 0; i < N; i++) {
+        test_assert(equeue_group_call(&g, simple_func, &touched));
+    }
+
+    usleep(10000);
+    test_assert(touched == 3*N);
+
+    equeue_break(&g.shards[ds[0].shard]);
+    err = pthread_join(threads[0], 0);
+    test_assert(!err);
+
+    // a thread should keep its local shard while alternating between groups
+    equeue_group_t g2;
+    err = equeue_group_create(&g2, 4, 2*N*EQUEUE_EVENT_SIZE);
+    test_assert(!err);
+
+    equeue_t *local1 = equeue_group_local(&g);
+    equeue_t *local2 = equeue_group_local(&g2);
+    for (int i = 0; i < N; i++) {
+        test_assert(equeue_group_local(&g) == local1);
+        test_assert(equeue_group_local(&g2) == local2);
+    }
+
+    equeue_group_destroy(&g2);
+    equeue_group_destroy(&g);
+}
+#endif
+
+struct producer {
+    equeue_t *q;
+    int *touched;
+    int count;
+};
+
+void *producer_thread(void *p) {
+    struct producer *producer = (struct producer *)p;
+    for (int i = 0; i < producer->count; i++) {
+        int id = equeue_call(producer->q, simple_func, producer->touched);
+        test_assert(id);
+    }
+    return 0;
+}
+
+void multiproducer_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, 16*N*EQUEUE_EVENT_SIZE + 17*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    int touched = 0;
+    struct producer producer = {&q, &touched, N};
+    pthread_t threads[16];
+    for (int i = 0; i < 16; i++) {
+        err = pthread_create(&threads[i], 0, producer_thread, &producer);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 100);
+
+    for (int i = 0; i < 16; i++) {
+        err = pthread_join(threads[i], 0);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 16*N);
+
+    equeue_destroy(&q);
+}
+
+void lockstats_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, 4*N*EQUEUE_EVENT_SIZE + 5*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    struct equeue_lockstats stats;
+    equeue_lockstats(&q, &stats);
+    test_assert(stats.queue_contended == 0 && stats.queue_parked == 0);
+    test_assert(stats.mem_contended == 0 && stats.mem_parked == 0);
+
+    int touched = 0;
+    struct producer producer = {&q, &touched, N};
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        err = pthread_create(&threads[i], 0, producer_thread, &producer);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 50);
+
+    for (int i = 0; i < 4; i++) {
+        err = pthread_join(threads[i], 0);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 4*N);
+
+    equeue_lockstats(&q, &stats);
+    test_assert(stats.queue_parked <= stats.queue_contended);
+    test_assert(stats.mem_parked <= stats.mem_contended);
+
+    equeue_destroy(&q);
+}
+
+void *flush_thread(void *p) {
+    equeue_t *q = (equeue_t *)p;
+    void *e = equeue_alloc(q, sizeof(int));
+    test_assert(e);
+    equeue_dealloc(q, e);
+    equeue_cache_flush(q);
+    return 0;
+}
+
+void cachestats_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, (4*N+1)*EQUEUE_EVENT_SIZE + 5*TEST_THREAD_SIZE);
+    test_assert(!err);
+
+    struct equeue_cachestats stats;
+    equeue_cachestats(&q, &stats);
+    test_assert(stats.caches == 0 && stats.cached == 0);
+    test_assert(stats.hits == 0 && stats.misses == 0 && stats.flushes == 0);
+
+    for (int i = 0; i < N; i++) {
+        void *e = equeue_alloc(&q, sizeof(int));
+        test_assert(e);
+        equeue_dealloc(&q, e);
+    }
+
+    // producers allocate events that are freed by the dispatching thread
+    int touched = 0;
+    struct producer producer = {&q, &touched, N};
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        err = pthread_create(&threads[i], 0, producer_thread, &producer);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 50);
+
+    for (int i = 0; i < 4; i++) {
+        err = pthread_join(threads[i], 0);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 4*N);
+
+    equeue_cachestats(&q, &stats);
+#if defined(EQUEUE_THREAD_CACHE)
+    test_assert(stats.caches >= 1 && stats.caches <= 5);
+    test_assert(stats.hits >= (unsigned)N-1);
+    test_assert(stats.cached <=
+            stats.caches*EQUEUE_CACHE_CLASSES*EQUEUE_CACHE_LIMIT);
+#else
+    test_assert(stats.caches == 0 && stats.cached == 0);
+    test_assert(stats.hits == 0 && stats.misses == 0 && stats.flushes == 0);
+#endif
+
+    // flushing releases the calling thread's cache
+    unsigned caches = stats.caches;
+    equeue_cache_flush(&q);
+    equeue_cachestats(&q, &stats);
+#if defined(EQUEUE_THREAD_CACHE)
+    test_assert(stats.caches == caches-1);
+#else
+    test_assert(stats.caches == 0);
+#endif
+
+    // short-lived threads that flush don't leave caches behind, they may
+    // even adopt and release caches stranded by the producers
+    caches = stats.caches;
+    for (int i = 0; i < 8; i++) {
+        pthread_t thread;
+        err = pthread_create(&thread, 0, flush_thread, &q);
+        test_assert(!err);
+        err = pthread_join(thread, 0);
+        test_assert(!err);
+    }
+
+    equeue_cachestats(&q, &stats);
+    test_assert(stats.caches <= caches);
+
+    equeue_destroy(&q);
+}
+
 void background_func(void *p, int ms) {
     *(unsigned *)p = ms;
 }
@@ -641,6 +1810,15 @@ void break_request_cleared_on_timeout(void) {
     equeue_destroy(&q);
 }
 
+// follow an event link, compact events link by offset into the buffer
+static struct equeue_event *test_link(equeue_t *q, equeue_link_t l) {
+#if defined(EQUEUE_COMPACT_EVENTS)
+    return l ? (struct equeue_event *)&q->buffer[l - sizeof(void*)] : 0;
+#else
+    return l;
+#endif
+}
+
 void sibling_test(void) {
     equeue_t q;
     int err = equeue_create(&q, 1024);
@@ -650,10 +1828,11 @@ void sibling_test(void) {
     int id1 = equeue_call_in(&q, 1, pass_func, 0);
     int id2 = equeue_call_in(&q, 1, pass_func, 0);
 
-    struct equeue_event *e = q.queue;
+    struct equeue_event *e = test_link(&q, q.queue);
 
-    for (; e; e = e->next) {
-        for (struct equeue_event *s = e->sibling; s; s = s->sibling) {
+    for (; e; e = test_link(&q, e->next)) {
+        for (struct equeue_event *s = test_link(&q, e->sibling); s;
+                s = test_link(&q, s->sibling)) {
             test_assert(!s->next);
         }
     }
@@ -663,10 +1842,229 @@ void sibling_test(void) {
     equeue_destroy(&q);
 }
 
+void ordering_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*TEST_EVENT_SIZE(sizeof(struct order)));
+    test_assert(!err);
+
+    int *delays = malloc(N*sizeof(int));
+    int *log = malloc(N*sizeof(int));
+    int count = 0;
+
+    for (int i = 0; i < N; i++) {
+        struct order *order = equeue_alloc(&q, sizeof(struct order));
+        test_assert(order);
+
+        order->log = log;
+        order->count = &count;
+        order->i = i;
+        delays[i] = ((i*7919) % 13) * 50;
+        equeue_event_delay(order, delays[i]);
+
+        int id = equeue_post(&q, order_func, order);
+        test_assert(id);
+    }
+
+    equeue_dispatch(&q, 700);
+    test_assert(count == N);
+
+    for (int i = 1; i < N; i++) {
+        int a = log[i-1];
+        int b = log[i];
+        test_assert(delays[a] < delays[b] ||
+                (delays[a] == delays[b] && a < b));
+    }
+
+    free(delays);
+    free(log);
+    equeue_destroy(&q);
+}
+
+struct preempt {
+    struct order order;
+    equeue_t *q;
+};
+
+void preempt_func(void *p) {
+    struct preempt *preempt = (struct preempt *)p;
+    order_func(&preempt->order);
+
+    struct order *order = equeue_alloc(preempt->q, sizeof(struct order));
+    test_assert(order);
+    *order = preempt->order;
+    order->i = -1;
+    equeue_event_priority(order, EQUEUE_PRIORITY_LEVELS-1);
+    test_assert(equeue_post(preempt->q, order_func, order));
+}
+
+// post an event that posts an urgent event, followed by a batch of events
+void preempt_post(equeue_t *q, int N, int *log, int *count) {
+    *count = 0;
+    struct preempt *preempt = equeue_alloc(q, sizeof(struct preempt));
+    test_assert(preempt);
+    preempt->order = (struct order){log, count, 0};
+    preempt->q = q;
+    test_assert(equeue_post(q, preempt_func, preempt));
+
+    for (int i = 1; i < N; i++) {
+        struct order *order = equeue_alloc(q, sizeof(struct order));
+        test_assert(order);
+        *order = (struct order){log, count, i};
+        test_assert(equeue_post(q, order_func, order));
+    }
+}
+
+void preempt_check(int N, int *log, int count) {
+    test_assert(count == N+1);
+    test_assert(log[0] == 0);
+#if defined(EQUEUE_PRIORITIES)
+    test_assert(log[1] == -1);
+#else
+    test_assert(log[N] == -1);
+#endif
+}
+
+void priority_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, 2*N*TEST_EVENT_SIZE(sizeof(struct preempt)));
+    test_assert(!err);
+
+    int *prios = malloc(N*sizeof(int));
+    int *ids = malloc(N*sizeof(int));
+    int *log = malloc(2*N*sizeof(int));
+    int count = 0;
+
+    // ready and delayed events should run by priority, then in post order,
+    // canceled events should leave the order of the rest alone
+    for (int j = 0; j < 2; j++) {
+        count = 0;
+        for (int i = 0; i < N; i++) {
+            struct order *order = equeue_alloc(&q, sizeof(struct order));
+            test_assert(order);
+
+            order->log = log;
+            order->count = &count;
+            order->i = i;
+            prios[i] = (i*7919) % EQUEUE_PRIORITY_LEVELS;
+            equeue_event_priority(order, prios[i]);
+            equeue_event_delay(order, j*10);
+
+            ids[i] = equeue_post(&q, order_func, order);
+            test_assert(ids[i]);
+        }
+
+        for (int i = 0; i < N; i += 3) {
+            equeue_cancel(&q, ids[i]);
+        }
+
+        // let delayed events expire together
+        usleep(j*20000);
+        equeue_dispatch(&q, 0);
+        test_assert(count == N - (N+2)/3);
+
+        for (int i = 1; i < count; i++) {
+            int a = log[i-1];
+            int b = log[i];
+            test_assert(a % 3 && b % 3);
+#if defined(EQUEUE_PRIORITIES)
+            test_assert(prios[a] > prios[b] ||
+                    (prios[a] == prios[b] && a < b));
+#else
+            test_assert(a < b);
+#endif
+        }
+    }
+
+    // urgent events posted during a batch should run before the rest of
+    // the batch, in every dispatch loop
+    preempt_post(&q, N, log, &count);
+    equeue_dispatch(&q, 10);
+    preempt_check(N, log, count);
+
+#if defined(EQUEUE_WORKERS)
+    preempt_post(&q, N, log, &count);
+    equeue_dispatch_workers(&q, 1, 10);
+    preempt_check(N, log, count);
+#endif
+
+#if defined(EQUEUE_GROUPS)
+    equeue_group_t g;
+    err = equeue_group_create(&g, 1,
+            2*N*TEST_EVENT_SIZE(sizeof(struct preempt)));
+    test_assert(!err);
+
+    preempt_post(equeue_group_local(&g), N, log, &count);
+    equeue_group_dispatch(&g, 0, 10);
+    preempt_check(N, log, count);
+
+    equeue_group_destroy(&g);
+#endif
+    free(prios);
+    free(ids);
+    free(log);
+    equeue_destroy(&q);
+}
+
+void batch_test(int N) {
+    equeue_t q;
+    int err = equeue_create(&q, N*TEST_EVENT_SIZE(sizeof(struct order)));
+    test_assert(!err);
+
+    void **events = malloc(N*sizeof(void*));
+    int *ids = malloc(N*sizeof(int));
+    int *delays = malloc(N*sizeof(int));
+    int *log = malloc(N*sizeof(int));
+    int count = 0;
+
+    int allocated = equeue_alloc_batch(&q, sizeof(struct order), events, N);
+    test_assert(allocated == N);
+
+    for (int i = 0; i < N; i++) {
+        struct order *order = events[i];
+        order->log = log;
+        order->count = &count;
+        order->i = i;
+        delays[i] = (i % 3) ? ((i*7919) % 5) * 50 : 0;
+        equeue_event_delay(order, delays[i]);
+    }
+
+    equeue_post_batch(&q, order_func, events, ids, N);
+
+    // cancel every fourth event
+    int cancelled = 0;
+    for (int i = 0; i < N; i += 4) {
+        equeue_cancel(&q, ids[i]);
+        delays[i] = -1;
+        cancelled += 1;
+    }
+
+    equeue_dispatch(&q, 300);
+    test_assert(count == N - cancelled);
+
+    for (int i = 0; i < count; i++) {
+        test_assert(delays[log[i]] >= 0);
+    }
+
+    for (int i = 1; i < count; i++) {
+        int a = log[i-1];
+        int b = log[i];
+        test_assert(delays[b] == 0 ||
+                delays[a] < delays[b] ||
+                (delays[a] == delays[b] && a < b));
+    }
+
+    free(events);
+    free(ids);
+    free(delays);
+    free(log);
+    equeue_destroy(&q);
+}
+
 // Barrage tests
 void simple_barrage_test(int N) {
     equeue_t q;
-    int err = equeue_create(&q, N*(EQUEUE_EVENT_SIZE+sizeof(struct timing)));
+    int err = equeue_create(&q, N*TEST_EVENT_SIZE(sizeof(struct timing))
+            + TEST_THREAD_SIZE);
     test_assert(!err);
 
     for (int i = 0; i < N; i++) {
@@ -690,7 +2088,7 @@ void simple_barrage_test(int N) {
 void fragmenting_barrage_test(int N) {
     equeue_t q;
     int err = equeue_create(&q,
-            2*N*(EQUEUE_EVENT_SIZE+sizeof(struct fragment)+N*sizeof(int)));
+            2*N*TEST_EVENT_SIZE(sizeof(struct fragment)+N*sizeof(int)));
     test_assert(!err);
 
     for (int i = 0; i < N; i++) {
@@ -727,7 +2125,8 @@ static void *ethread_dispatch(void *p) {
 
 void multithreaded_barrage_test(int N) {
     equeue_t q;
-    int err = equeue_create(&q, N*(EQUEUE_EVENT_SIZE+sizeof(struct timing)));
+    int err = equeue_create(&q, N*TEST_EVENT_SIZE(sizeof(struct timing))
+            + 2*TEST_THREAD_SIZE);
     test_assert(!err);
 
     struct ethread t;
@@ -764,21 +2163,53 @@ int main() {
     test_run(simple_post_test);
     test_run(destructor_test);
     test_run(allocation_failure_test);
+    test_run(allocation_reuse_test, 100);
+    test_run(allocation_pool_test, 100);
+    test_run(allocation_coalesce_test, 100);
+    test_run(allocation_mixed_test, 100);
+    test_run(extend_test, 100);
+    test_run(grow_test, 100);
+    test_run(create_flags_test, 100);
+    test_run(allocator_test, 20);
+    test_run(id64_test, 100);
+    test_run(event_size_test, 100);
+    test_run(cache_aligned_test, 20);
     test_run(cancel_test, 20);
     test_run(cancel_inflight_test);
+    test_run(cancel_ready_test);
     test_run(cancel_unnecessarily_test);
     test_run(loop_protect_test);
     test_run(break_test);
     test_run(break_no_windup_test);
     test_run(period_test);
+    test_run(slack_test);
+    test_run(microsecond_test);
     test_run(nested_test);
     test_run(sloth_test);
     test_run(background_test);
     test_run(chain_test);
     test_run(unchain_test);
     test_run(multithread_test);
+#if defined(EQUEUE_WORKERS)
+    test_run(dispatch_workers_test, 20);
+#endif
+#if defined(EQUEUE_GROUPS)
+    test_run(group_test, 20);
+#endif
+#if defined(EQUEUE_STRANDS)
+    test_run(strand_test, 20);
+#endif
+#if defined(EQUEUE_OFFLOAD)
+    test_run(offload_test, 20);
+#endif
+    test_run(multiproducer_test, 100);
+    test_run(lockstats_test, 100);
+    test_run(cachestats_test, 100);
     test_run(break_request_cleared_on_timeout);
     test_run(sibling_test);
+    test_run(ordering_test, 100);
+    test_run(batch_test, 100);
+    test_run(priority_test, 100);
     test_run(simple_barrage_test, 10);
     test_run(fragmenting_barrage_test, 10);
     test_run(multithreaded_barrage_test, 10);